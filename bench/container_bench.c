@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "containers.h"
+#include "os.h"
+
+// Throughput of the containers the compiler is built on, at sizes from 1e2 to 1e7 (or the size
+// given on the command line). Small sizes are repeated until every row covers at least
+// MIN_OPS operations, so timer resolution does not dominate.
+// Prints CSV: container,op,n,ns_per_op,mops_per_sec
+
+#define MIN_OPS (1 << 22)
+#define MAX_SIZE 10000000
+#define NODE_SIZE 48
+
+static uint64_t rng_state = 0x853c49e6748fea9b;
+
+static uint64_t rng_next() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static volatile size_t sink;
+
+static size_t get_reps(size_t n) {
+    return n >= MIN_OPS ? 1 : MIN_OPS / n;
+}
+
+static void report(char* container, char* op, size_t n, size_t num_ops, uint64_t elapsed_ns) {
+    double ns = (double)elapsed_ns / num_ops;
+    printf("%s,%s,%zu,%.2f,%.2f\n", container, op, n, ns, 1000.0 / ns);
+}
+
+// Pushes of a node-sized block, reset between rounds like a scratch is
+static void bench_arena(size_t n) {
+    Arena* arena = arena_new();
+    size_t reps = get_reps(n);
+
+    uint64_t start = os_now_ns();
+
+    for (size_t r = 0; r < reps; ++r) {
+        for (size_t i = 0; i < n; ++i) {
+            sink += (size_t)arena_push(arena, NODE_SIZE);
+        }
+        arena_reset(arena);
+    }
+
+    report("arena", "push", n, n * reps, os_now_ns() - start);
+
+    start = os_now_ns();
+
+    for (size_t r = 0; r < reps; ++r) {
+        for (size_t i = 0; i < n; ++i) {
+            sink += (size_t)arena_zero(arena, NODE_SIZE);
+        }
+        arena_reset(arena);
+    }
+
+    report("arena", "zero", n, n * reps, os_now_ns() - start);
+
+    arena_destroy(arena);
+}
+
+static void bench_vec(size_t n) {
+    size_t reps = get_reps(n);
+
+    Vec(size_t) vec = 0;
+    uint64_t push_ns = 0;
+    uint64_t pop_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = os_now_ns();
+        for (size_t i = 0; i < n; ++i) {
+            vec_push(vec, i);
+        }
+        push_ns += os_now_ns() - start;
+
+        start = os_now_ns();
+        for (size_t i = 0; i < n; ++i) {
+            sink += vec_pop(vec);
+        }
+        pop_ns += os_now_ns() - start;
+
+        // Start from null each round so growth is part of the measurement
+        vec_destroy(vec);
+        vec = 0;
+    }
+
+    report("vec", "push", n, n * reps, push_ns);
+    report("vec", "pop", n, n * reps, pop_ns);
+
+    Arena* arena = arena_new();
+    uint64_t start = os_now_ns();
+
+    for (size_t r = 0; r < reps; ++r) {
+        Vec(size_t) arena_vec = vec_new(arena, size_t, 0);
+        for (size_t i = 0; i < n; ++i) {
+            vec_push(arena_vec, i);
+        }
+        arena_reset(arena);
+    }
+
+    report("vec", "push_arena", n, n * reps, os_now_ns() - start);
+
+    arena_destroy(arena);
+}
+
+// Inserts all keys, looks up a 50/50 mix of present and absent keys, then removes them all.
+// 'keys' holds 2n keys of 'key_size' bytes, the first n of which go in the set.
+static void bench_hash_set(char* container, size_t n, size_t key_size, uint8_t* keys, ContainerHashFn hash_fn, ContainerCmpFn cmp_fn) {
+    size_t reps = get_reps(n);
+
+    uint64_t insert_ns = 0;
+    uint64_t remove_ns = 0;
+
+    HashSet set = hash_set_new(key_size, hash_fn, cmp_fn);
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = os_now_ns();
+        for (size_t i = 0; i < n; ++i) {
+            hash_set_insert(&set, keys + i * key_size);
+        }
+        insert_ns += os_now_ns() - start;
+
+        if (r + 1 == reps) { break; }
+
+        start = os_now_ns();
+        for (size_t i = 0; i < n; ++i) {
+            hash_set_remove(&set, keys + i * key_size);
+        }
+        remove_ns += os_now_ns() - start;
+    }
+
+    size_t hits = 0;
+    size_t num_lookups = n * reps;
+    uint64_t start = os_now_ns();
+
+    for (size_t i = 0; i < num_lookups; ++i) {
+        hits += hash_set_contains(&set, keys + (rng_next() % (2 * n)) * key_size);
+    }
+
+    uint64_t contains_ns = os_now_ns() - start;
+    sink += hits;
+
+    start = os_now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        hash_set_remove(&set, keys + i * key_size);
+    }
+    remove_ns += os_now_ns() - start;
+
+    report(container, "insert", n, n * reps, insert_ns);
+    report(container, "contains", n, num_lookups, contains_ns);
+    report(container, "remove", n, n * reps, remove_ns);
+
+    hash_set_destroy(&set);
+}
+
+static void bench_hash_set_pointer(size_t n) {
+    Arena* arena = arena_new();
+
+    void** keys = arena_array(arena, void*, 2 * n);
+    for (size_t i = 0; i < 2 * n; ++i) { keys[i] = arena_push(arena, NODE_SIZE); }
+
+    bench_hash_set("hash_set_pointer", n, sizeof(void*), (uint8_t*)keys, pointer_hash, pointer_cmp);
+
+    arena_destroy(arena);
+}
+
+static void bench_hash_set_string(size_t n) {
+    Arena* arena = arena_new();
+
+    static char* stems[] = { "x", "i", "tmp", "count", "node_index", "accumulated_value_for_loop" };
+
+    String* keys = arena_array(arena, String, 2 * n);
+
+    for (size_t i = 0; i < 2 * n; ++i) {
+        char buffer[64];
+        int length = snprintf(buffer, sizeof(buffer), "%s%zu", stems[i % ARRAY_LENGTH(stems)], i);
+
+        keys[i].str = arena_push(arena, length);
+        keys[i].length = length;
+        memcpy(keys[i].str, buffer, length);
+    }
+
+    bench_hash_set("hash_set_string", n, sizeof(String), (uint8_t*)keys, string_hash, string_cmp);
+
+    arena_destroy(arena);
+}
+
+// Random single-bit access over an n-bit set
+static void bench_bitset(size_t n) {
+    Arena* arena = arena_new();
+    Bitset* set = bitset_alloc(arena, n);
+
+    size_t num_ops = n * get_reps(n);
+
+    uint64_t start = os_now_ns();
+    for (size_t i = 0; i < num_ops; ++i) {
+        bitset_set(set, rng_next() % n);
+    }
+    report("bitset", "set", n, num_ops, os_now_ns() - start);
+
+    size_t hits = 0;
+    start = os_now_ns();
+    for (size_t i = 0; i < num_ops; ++i) {
+        hits += bitset_get(set, rng_next() % n);
+    }
+    report("bitset", "get", n, num_ops, os_now_ns() - start);
+    sink += hits;
+
+    start = os_now_ns();
+    for (size_t i = 0; i < num_ops; ++i) {
+        bitset_unset(set, rng_next() % n);
+    }
+    report("bitset", "unset", n, num_ops, os_now_ns() - start);
+
+    arena_destroy(arena);
+}
+
+// Whole-set operations over two half-full n-bit sets, reported per word
+static void bench_bitset_bulk(size_t n) {
+    Arena* arena = arena_new();
+
+    Bitset* a = bitset_alloc(arena, n);
+    Bitset* b = bitset_alloc(arena, n);
+
+    size_t num_words = bitset_num_words(a);
+
+    for (size_t i = 0; i < num_words; ++i) {
+        a->words[i] = rng_next();
+        b->words[i] = rng_next();
+    }
+
+    // Keep the bits past num_bits clear
+    if (n % 64) {
+        uint64_t mask = ((uint64_t)1 << (n % 64)) - 1;
+        a->words[num_words-1] &= mask;
+        b->words[num_words-1] &= mask;
+    }
+
+    size_t reps = get_reps(num_words);
+
+    Bitset* dst = bitset_alloc(arena, n);
+
+    uint64_t start = os_now_ns();
+    for (size_t r = 0; r < reps; ++r) {
+        bitset_copy(dst, a);
+        sink += bitset_union(dst, b);
+    }
+    report("bitset", "copy_union", n, num_words * reps, os_now_ns() - start);
+
+    start = os_now_ns();
+    for (size_t r = 0; r < reps; ++r) {
+        // Unchanged after the first round, the fixpoint case
+        sink += bitset_intersect(a, b);
+    }
+    report("bitset", "intersect", n, num_words * reps, os_now_ns() - start);
+
+    start = os_now_ns();
+    for (size_t r = 0; r < reps; ++r) {
+        sink += bitset_count(b);
+    }
+    report("bitset", "count", n, num_words * reps, os_now_ns() - start);
+
+    start = os_now_ns();
+    for (size_t r = 0; r < reps; ++r) {
+        for (size_t i = bitset_find_first(b); i < b->num_bits; i = bitset_find_next(b, i + 1)) {
+            sink += i;
+        }
+    }
+    report("bitset", "iterate", n, num_words * reps, os_now_ns() - start);
+
+    arena_destroy(arena);
+}
+
+int main(int argc, char** argv) {
+    size_t max_size = MAX_SIZE;
+
+    if (argc > 1) {
+        max_size = strtoull(argv[1], 0, 10);
+    }
+
+    printf("container,op,n,ns_per_op,mops_per_sec\n");
+
+    for (size_t n = 100; n <= max_size; n *= 10) {
+        bench_arena(n);
+        bench_vec(n);
+        bench_hash_set_pointer(n);
+        bench_hash_set_string(n);
+        bench_bitset(n);
+        bench_bitset_bulk(n);
+        fflush(stdout);
+    }
+
+    return 0;
+}
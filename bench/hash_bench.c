@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "containers.h"
+#include "os.h"
+
+// Lookup throughput of HashSet with the default hashes against the fnv1a ones they replaced, on
+// the two workloads that dominate the compiler: sets of node pointers and identifier maps. The
+// churn workload replays the insert/remove pattern of the sb_opt worklist. The node_set workload
+// also runs on a typed set from hash_map.inc.
+// Prints CSV: workload,hash,n,ns_per_op,mops_per_sec
+
+#define MAP_NAME PointerSet
+#define MAP_PREFIX pointer_set
+#define MAP_KEY void*
+#define MAP_HASH(k) hash_u64((uint64_t)(k))
+#define MAP_EQ(a, b) ((a) == (b))
+#include "hash_map.inc"
+
+#define NODE_SIZE 48
+#define NUM_LOOKUPS 4000000
+#define NUM_CHURN_OPS 4000000
+
+typedef struct {
+    char* name;
+    ContainerHashFn pointer_hash_fn;
+    ContainerHashFn string_hash_fn;
+} HashChoice;
+
+static HashChoice choices[] = {
+    { "fnv1a", pointer_hash_fnv1a, string_hash_fnv1a },
+    { "default", pointer_hash, string_hash },
+};
+
+static uint64_t rng_state = 0x853c49e6748fea9b;
+
+static uint64_t rng_next() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static volatile size_t sink;
+
+static void report(char* workload, char* hash, size_t n, uint64_t elapsed_ns) {
+    double ns = (double)elapsed_ns / NUM_LOOKUPS;
+    printf("%s,%s,%zu,%.2f,%.2f\n", workload, hash, n, ns, 1000.0 / ns);
+}
+
+// Node pointers come out of an arena at a fixed stride, like SB_Nodes do.
+// Half the lookups hit, half miss on pointers from a second arena.
+static void bench_node_set(HashChoice* choice, size_t n) {
+    Arena* arena = arena_new();
+
+    void** present = arena_array(arena, void*, n);
+    void** absent = arena_array(arena, void*, n);
+
+    for (size_t i = 0; i < n; ++i) { present[i] = arena_push(arena, NODE_SIZE); }
+    for (size_t i = 0; i < n; ++i) { absent[i] = arena_push(arena, NODE_SIZE); }
+
+    HashSet set = hash_set_new(sizeof(void*), choice->pointer_hash_fn, pointer_cmp);
+
+    for (size_t i = 0; i < n; ++i) {
+        hash_set_insert(&set, &present[i]);
+    }
+
+    size_t hits = 0;
+    uint64_t start = os_now_ns();
+
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+        uint64_t r = rng_next();
+        void** keys = (r & 1) ? present : absent;
+        hits += hash_set_contains(&set, &keys[(r >> 1) % n]);
+    }
+
+    report("node_set", choice->name, n, os_now_ns() - start);
+    sink += hits;
+
+    hash_set_destroy(&set);
+    arena_destroy(arena);
+}
+
+// Same workload on the typed set from hash_map.inc, where hash and compare are inlined
+static void bench_node_set_typed(size_t n) {
+    Arena* arena = arena_new();
+
+    void** present = arena_array(arena, void*, n);
+    void** absent = arena_array(arena, void*, n);
+
+    for (size_t i = 0; i < n; ++i) { present[i] = arena_push(arena, NODE_SIZE); }
+    for (size_t i = 0; i < n; ++i) { absent[i] = arena_push(arena, NODE_SIZE); }
+
+    PointerSet set = pointer_set_new();
+
+    for (size_t i = 0; i < n; ++i) {
+        pointer_set_insert(&set, present[i]);
+    }
+
+    size_t hits = 0;
+    uint64_t start = os_now_ns();
+
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+        uint64_t r = rng_next();
+        void** keys = (r & 1) ? present : absent;
+        hits += pointer_set_contains(&set, keys[(r >> 1) % n]);
+    }
+
+    report("node_set", "typed", n, os_now_ns() - start);
+    sink += hits;
+
+    pointer_set_destroy(&set);
+    arena_destroy(arena);
+}
+
+// Identifiers of mixed length, looked up through copies so every hit really compares bytes
+static void bench_identifiers(HashChoice* choice, size_t n) {
+    Arena* arena = arena_new();
+
+    String* names = arena_array(arena, String, n);
+    String* queries = arena_array(arena, String, n);
+
+    static char* stems[] = { "x", "i", "tmp", "count", "node_index", "accumulated_value_for_loop" };
+
+    for (size_t i = 0; i < n; ++i) {
+        char buffer[64];
+        int length = snprintf(buffer, sizeof(buffer), "%s%zu", stems[i % ARRAY_LENGTH(stems)], i);
+
+        names[i].str = arena_push(arena, length);
+        names[i].length = length;
+        memcpy(names[i].str, buffer, length);
+
+        queries[i].str = arena_push(arena, length);
+        queries[i].length = length;
+        memcpy(queries[i].str, buffer, length);
+
+        // Every other query differs in its last byte and misses
+        if (i & 1) { queries[i].str[length - 1] = '_'; }
+    }
+
+    HashMap map = hash_map_new(sizeof(String), sizeof(void*), choice->string_hash_fn, string_cmp);
+
+    for (size_t i = 0; i < n; ++i) {
+        void* value = &names[i];
+        hash_map_insert(&map, &names[i], &value);
+    }
+
+    size_t hits = 0;
+    uint64_t start = os_now_ns();
+
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+        hits += hash_map_contains(&map, &queries[rng_next() % n]);
+    }
+
+    report("identifiers", choice->name, n, os_now_ns() - start);
+    sink += hits;
+
+    hash_map_destroy(&map);
+    arena_destroy(arena);
+}
+
+// Like the opt.c worklist: a stack of nodes plus a node -> stack index map. Nodes are pushed,
+// popped and removed from the middle (moving the last entry into the hole) at random.
+static void bench_worklist_churn(HashChoice* choice, size_t n) {
+    Arena* arena = arena_new();
+
+    size_t pool_size = n * 2;
+    void** pool = arena_array(arena, void*, pool_size);
+    for (size_t i = 0; i < pool_size; ++i) { pool[i] = arena_push(arena, NODE_SIZE); }
+
+    void** stack = arena_array(arena, void*, pool_size);
+    size_t stack_len = 0;
+
+    HashMap index_map = hash_map_new(sizeof(void*), sizeof(size_t), choice->pointer_hash_fn, pointer_cmp);
+
+    uint64_t start = os_now_ns();
+
+    for (size_t i = 0; i < NUM_CHURN_OPS; ++i) {
+        uint64_t r = rng_next();
+
+        if (stack_len < n || (r & 3) == 0) {
+            void* node = pool[(r >> 2) % pool_size];
+            if (hash_map_contains(&index_map, &node)) { continue; }
+
+            stack[stack_len] = node;
+            hash_map_insert(&index_map, &node, &stack_len);
+            stack_len++;
+        }
+        else if ((r & 3) == 1) {
+            void* node = stack[--stack_len];
+            hash_map_remove(&index_map, &node);
+        }
+        else {
+            void* node = stack[(r >> 2) % stack_len];
+            size_t index = *(size_t*)hash_map_get(&index_map, &node);
+
+            void* last = stack[index] = stack[--stack_len];
+            hash_map_insert(&index_map, &last, &index);
+            hash_map_remove(&index_map, &node);
+        }
+    }
+
+    uint64_t elapsed = os_now_ns() - start;
+
+    double ns = (double)elapsed / NUM_CHURN_OPS;
+    printf("churn,%s,%zu,%.2f,%.2f\n", choice->name, n, ns, 1000.0 / ns);
+
+    hash_map_destroy(&index_map);
+    arena_destroy(arena);
+}
+
+int main() {
+    size_t sizes[] = { 100, 10000, 1000000 };
+
+    printf("workload,hash,n,ns_per_op,mops_per_sec\n");
+
+    for (int i = 0; i < ARRAY_LENGTH(sizes); ++i) {
+        for (int j = 0; j < ARRAY_LENGTH(choices); ++j) {
+            bench_node_set(&choices[j], sizes[i]);
+        }
+
+        bench_node_set_typed(sizes[i]);
+    }
+
+    for (int i = 0; i < ARRAY_LENGTH(sizes); ++i) {
+        for (int j = 0; j < ARRAY_LENGTH(choices); ++j) {
+            bench_identifiers(&choices[j], sizes[i]);
+        }
+    }
+
+    for (int i = 0; i < ARRAY_LENGTH(sizes); ++i) {
+        for (int j = 0; j < ARRAY_LENGTH(choices); ++j) {
+            bench_worklist_churn(&choices[j], sizes[i]);
+        }
+    }
+
+    return 0;
+}
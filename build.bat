@@ -1,6 +1,12 @@
 @echo off
 
-call :build bootstrap "src/*.c src/sb/*.c"
+call :build bootstrap "src/*.c src/sb/*.c" debug
+if %errorlevel% neq 0 exit /b %errorlevel%
+
+call :build hash_bench "bench/hash_bench.c src/arena.c src/hash_table.c src/win32.c src/posix.c" release
+if %errorlevel% neq 0 exit /b %errorlevel%
+
+call :build container_bench "bench/container_bench.c src/arena.c src/vec.c src/hash_table.c src/win32.c src/posix.c" release
 
 exit /b %errorlevel%
 
@@ -14,7 +20,12 @@ set options=%options% /Fobuild/ /Isrc/
 set debug_opts=/ZI /Fdbuild/
 set debug_opts=%debug_opts% /D_DEBUG
 
-cl %options% %debug_opts% /Febuild/%~1.exe %~2
+rem Benchmarks are only meaningful optimized
+set release_opts=/O2 /Zi /Fdbuild/
+
+if "%~3"=="release" (set config_opts=%release_opts%) else (set config_opts=%debug_opts%)
+
+cl %options% %config_opts% /Febuild/%~1.exe %~2
 
 exit /b %errorlevel%
 
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Linux counterpart of build.bat
+
+set -e
+
+# The warnings gcc adds over MSVC's /W4 for idioms used throughout the tree (int loop counters
+# against ARRAY_LENGTH, partial switches over enums, discarding vec_pop) are left off
+options="-std=c11 -Wall -Wextra -Werror -Wno-sign-compare -Wno-switch -Wno-unused-value -Isrc/"
+
+debug_opts="-g -D_DEBUG"
+
+# Benchmarks are only meaningful optimized
+release_opts="-O2 -g"
+
+build() {
+    mkdir -p build
+
+    if [ "$3" = "release" ]; then
+        config_opts=$release_opts
+    else
+        config_opts=$debug_opts
+    fi
+
+    ${CC:-cc} $options $config_opts -o build/$1 $2
+}
+
+build bootstrap "src/*.c src/sb/*.c" debug
+build hash_bench "bench/hash_bench.c src/arena.c src/hash_table.c src/win32.c src/posix.c" release
+build container_bench "bench/container_bench.c src/arena.c src/vec.c src/hash_table.c src/win32.c src/posix.c" release
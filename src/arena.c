@@ -0,0 +1,332 @@
+#include <stdlib.h>
+
+#include "os.h"
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#define RESERVE_SIZE ((size_t)1024 * 1024 * 1024 * 64)
+
+#define DEFAULT_MIN_COMMIT (64 * 1024)
+#define MAX_COMMIT_STEP (64 * 1024 * 1024)
+
+struct Arena {
+    size_t page_size;
+    size_t min_commit;
+    bool decommit_on_reset;
+
+    size_t base;
+    size_t used;
+    size_t capacity;
+
+    size_t num_commits;
+    size_t num_decommits;
+
+    size_t pushed;
+    size_t peak_used;
+    size_t peak_committed;
+
+    size_t scope_peak; // Highest 'used' since the innermost live scratch was taken
+    size_t peak_scratch;
+};
+
+static size_t align_up(size_t x, size_t alignment) {
+    return (x + alignment - 1) & ~(alignment - 1);
+}
+
+Arena* arena_new_ex(ArenaDesc desc) {
+    size_t page_size = desc.huge_pages ? os_huge_page_size() : os_page_size();
+
+    void* memory = os_reserve(RESERVE_SIZE, page_size, desc.huge_pages);
+    assert("virtual alloc failed" && memory);
+
+    size_t min_commit = desc.min_commit ? desc.min_commit : DEFAULT_MIN_COMMIT;
+
+    Arena* arena = calloc(1, sizeof(Arena));
+    arena->base = (size_t)memory;
+    arena->capacity = 0;
+    arena->page_size = page_size;
+    arena->min_commit = align_up(min_commit, page_size);
+    arena->decommit_on_reset = desc.decommit_on_reset;
+
+    return arena;
+}
+
+Arena* arena_new() {
+    return arena_new_ex((ArenaDesc) {0});
+}
+
+void arena_destroy(Arena* arena) {
+    os_release((void*)arena->base, RESERVE_SIZE);
+    free(arena);
+}
+
+// Grows the committed range to cover 'required' bytes in one call. Each commit at least doubles
+// what is already committed (up to MAX_COMMIT_STEP), so a phase that keeps pushing pays a
+// logarithmic number of kernel transitions instead of one per page.
+static void commit(Arena* arena, size_t required) {
+    size_t step = arena->capacity;
+
+    if (step < arena->min_commit) { step = arena->min_commit; }
+    if (step > MAX_COMMIT_STEP) { step = MAX_COMMIT_STEP; }
+
+    size_t new_capacity = align_up(required, arena->page_size);
+
+    if (new_capacity < arena->capacity + step) {
+        new_capacity = arena->capacity + step;
+    }
+
+    if (new_capacity > RESERVE_SIZE) {
+        new_capacity = RESERVE_SIZE;
+    }
+
+    assert("arena reservation exhausted" && new_capacity >= required);
+
+    bool result = os_commit((void*)(arena->base + arena->capacity), new_capacity - arena->capacity);
+    assert("memory commit failed" && result);
+    (void)result;
+
+    arena->capacity = new_capacity;
+    arena->num_commits++;
+
+    if (arena->capacity > arena->peak_committed) {
+        arena->peak_committed = arena->capacity;
+    }
+}
+
+// Gives committed pages past the live region back to the OS. Only done once more than half of
+// what is committed sits idle, so a scratch arena bouncing around one size does not thrash.
+static void decommit_idle(Arena* arena) {
+    size_t retain = align_up(arena->used, arena->page_size) + arena->min_commit;
+
+    if (arena->capacity <= retain * 2) {
+        return;
+    }
+
+    os_decommit((void*)(arena->base + retain), arena->capacity - retain);
+
+    arena->capacity = retain;
+    arena->num_decommits++;
+}
+
+void* arena_push(Arena* arena, size_t amount) {
+    if (!amount) {
+        return 0;
+    }
+
+    amount = (amount + 7) & ~7;
+
+    if (arena->used + amount > arena->capacity) {
+        commit(arena, arena->used + amount);
+    }
+
+    size_t result = arena->base + arena->used;
+    arena->used += amount;
+    arena->pushed += amount;
+
+    if (arena->used > arena->peak_used) { arena->peak_used = arena->used; }
+    if (arena->used > arena->scope_peak) { arena->scope_peak = arena->used; }
+
+    return (void*)result;
+}
+
+void* arena_zero(Arena* arena, size_t amount) {
+    void* result = arena_push(arena, amount);
+    memset(result, 0, amount);
+    return result;
+}
+
+void arena_reset(Arena* arena) {
+    #if _DEBUG
+    memset((void*)arena->base, 0, arena->used);
+    #endif
+
+    arena->used = 0;
+    arena->scope_peak = 0;
+}
+
+void arena_trim(Arena* arena, size_t keep_committed) {
+    size_t keep = align_up(arena->used > keep_committed ? arena->used : keep_committed, arena->page_size);
+
+    if (arena->capacity > keep) {
+        os_decommit((void*)(arena->base + keep), arena->capacity - keep);
+        arena->capacity = keep;
+        arena->num_decommits++;
+    }
+}
+
+bool arena_try_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    old_size = (old_size + 7) & ~7;
+    new_size = (new_size + 7) & ~7;
+
+    if ((size_t)ptr + old_size != arena->base + arena->used) {
+        return false;
+    }
+
+    if (new_size > old_size) {
+        arena_push(arena, new_size - old_size);
+    }
+
+    return true;
+}
+
+Scratch* scratch_get(ScratchLibrary* lib, int num_conflicts, Arena** conflicts) {
+    for (int i = 0; i < ARRAY_LENGTH(lib->arenas); ++i) {
+        Arena* arena = lib->arenas[i];
+
+        bool does_conflict = false;
+
+        for (int j = 0; j < num_conflicts; ++j) {
+            if (conflicts[j] == arena) {
+                does_conflict = true;
+                break;
+            }
+        }
+
+        if (!does_conflict) {
+            size_t save = arena->used;
+            size_t outer_peak = arena->scope_peak;
+            arena->scope_peak = save;
+
+            Scratch* scratch = arena_type(arena, Scratch);
+            scratch->arena = arena;
+            scratch->save = save;
+            scratch->outer_peak = outer_peak;
+            return scratch;
+        }
+    }
+
+    assert("No non-conflicting scratch buffers available" && false);
+    return 0;
+}
+
+void scratch_release(Scratch* scratch) {
+    Arena* arena = scratch->arena;
+    size_t cur = scratch->arena->used;
+    arena->used = scratch->save;
+
+    size_t peak = arena->scope_peak - scratch->save;
+    if (peak > arena->peak_scratch) {
+        arena->peak_scratch = peak;
+    }
+
+    if (scratch->outer_peak > arena->scope_peak) {
+        arena->scope_peak = scratch->outer_peak;
+    }
+
+    #if _DEBUG
+    memset((uint8_t*)arena->base + arena->used, 0, cur-arena->used);
+    #else
+    (void)cur;
+    #endif
+
+    if (arena->decommit_on_reset) {
+        decommit_idle(arena);
+    }
+}
+
+ArenaPool arena_pool_new(ArenaDesc desc, size_t retain) {
+    return (ArenaPool) {
+        .desc = desc,
+        .retain = retain,
+    };
+}
+
+void arena_pool_destroy(ArenaPool* pool) {
+    for (int i = 0; i < pool->num_free; ++i) {
+        arena_destroy(pool->free[i]);
+    }
+
+    pool->num_free = 0;
+}
+
+Arena* arena_pool_get(ArenaPool* pool) {
+    if (pool->num_free) {
+        return pool->free[--pool->num_free];
+    }
+
+    return arena_new_ex(pool->desc);
+}
+
+void arena_pool_put(ArenaPool* pool, Arena* arena) {
+    if (pool->num_free == ARRAY_LENGTH(pool->free)) {
+        arena_destroy(arena);
+        return;
+    }
+
+    arena_reset(arena);
+
+    if (pool->retain) {
+        arena_trim(arena, pool->retain);
+    }
+
+    pool->free[pool->num_free++] = arena;
+}
+
+static THREAD_LOCAL ScratchLibrary thread_scratch_library;
+
+ScratchLibrary* get_thread_scratch_library() {
+    if (!thread_scratch_library.arenas[0]) {
+        thread_scratch_library = scratch_library_new();
+    }
+
+    return &thread_scratch_library;
+}
+
+void release_thread_scratch_library() {
+    if (thread_scratch_library.arenas[0]) {
+        scratch_library_destroy(&thread_scratch_library);
+        thread_scratch_library = (ScratchLibrary) {0};
+    }
+}
+
+ArenaStats arena_stats(Arena* arena) {
+    return (ArenaStats) {
+        .used = arena->used,
+        .committed = arena->capacity,
+        .pushed = arena->pushed,
+        .peak_used = arena->peak_used,
+        .peak_committed = arena->peak_committed,
+        .peak_scratch = arena->peak_scratch,
+        .num_commits = arena->num_commits,
+        .num_decommits = arena->num_decommits,
+    };
+}
+
+void arena_reset_peaks(Arena* arena) {
+    arena->peak_used = arena->used;
+    arena->peak_committed = arena->capacity;
+    arena->peak_scratch = 0;
+}
+
+ArenaStats arena_stats_combine(ArenaStats a, ArenaStats b) {
+    return (ArenaStats) {
+        .used = a.used + b.used,
+        .committed = a.committed + b.committed,
+        .pushed = a.pushed + b.pushed,
+        .peak_used = a.peak_used + b.peak_used,
+        .peak_committed = a.peak_committed + b.peak_committed,
+        .peak_scratch = a.peak_scratch > b.peak_scratch ? a.peak_scratch : b.peak_scratch,
+        .num_commits = a.num_commits + b.num_commits,
+        .num_decommits = a.num_decommits + b.num_decommits,
+    };
+}
+
+ArenaStats scratch_library_stats(ScratchLibrary* lib) {
+    ArenaStats stats = {0};
+
+    for (int i = 0; i < ARRAY_LENGTH(lib->arenas); ++i) {
+        stats = arena_stats_combine(stats, arena_stats(lib->arenas[i]));
+    }
+
+    return stats;
+}
+
+void scratch_library_reset_peaks(ScratchLibrary* lib) {
+    for (int i = 0; i < ARRAY_LENGTH(lib->arenas); ++i) {
+        arena_reset_peaks(lib->arenas[i]);
+    }
+}
@@ -4,6 +4,12 @@
 
 #define Vec(T) T*
 
+// Vectors start out null and live on the heap. vec_new instead places one in an arena, where
+// growing is a pointer bump while it is the arena's most recent allocation and vec_destroy is a
+// no-op - the memory goes away with the arena or scratch it came from.
+#define vec_new(arena, T, capacity) ((Vec(T))vec_alloc(arena, sizeof(T), capacity))
+
+void* vec_alloc(Arena* arena, size_t stride, size_t capacity);
 void vec_destroy(void* vec);
 void* vec_push_slot(void* vec, size_t stride);
 size_t vec_pop_index(void* vec);
@@ -16,20 +22,31 @@ void vec_clear(void* vec);
 typedef uint64_t(*ContainerHashFn)(void*);
 typedef bool(*ContainerCmpFn)(void*, void*);
 
-inline uint64_t pointer_hash(void* ptr) {
+// Default hashes. The fnv1a variants are kept for comparison, see bench/hash_bench.c
+
+static inline uint64_t pointer_hash(void* ptr) {
+    return hash_u64((uint64_t)*(void**)ptr);
+}
+
+static inline uint64_t pointer_hash_fnv1a(void* ptr) {
     return fnv1a(ptr, sizeof(ptr));
 }
 
-inline bool pointer_cmp(void* a, void* b) {
+static inline bool pointer_cmp(void* a, void* b) {
     return (*(void**)a) == (*(void**)b);
 }
 
-inline uint64_t string_hash(void* ptr) {
+static inline uint64_t string_hash(void* ptr) {
+    String str = *(String*)ptr;
+    return hash_bytes(str.str, str.length);
+}
+
+static inline uint64_t string_hash_fnv1a(void* ptr) {
     String str = *(String*)ptr;
     return fnv1a(str.str, str.length);
 }
 
-inline bool string_cmp(void* a, void* b) {
+static inline bool string_cmp(void* a, void* b) {
     String str_a = *(String*)a;
     String str_b = *(String*)b;
     return str_a.length == str_b.length && memcmp(str_a.str, str_b.str, str_a.length) == 0;
@@ -40,11 +57,12 @@ typedef struct {
     ContainerHashFn hash_fn;
     ContainerCmpFn cmp_fn;
 
-    size_t capacity;
+    size_t capacity; // Zero or a power of two, at least 16
     size_t used;
+    size_t growth_left; // Empty slots that can still be claimed before the 7/8 load limit
 
     void* keys;
-    uint8_t* states;
+    uint8_t* ctrl;
 } HashSet;
 
 HashSet hash_set_new(size_t key_size, ContainerHashFn hash_fn, ContainerCmpFn cmp_fn);
@@ -1,45 +1,98 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <memory.h>
 #include <string.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+// Only with /arch:AVX2 or -mavx2. There is no runtime dispatch
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HAVE_AVX2 1
+#endif
+
 #define ARRAY_LENGTH(arr) (sizeof(arr)/sizeof((arr)[0]))
 
-// Defined in os file
+// Defined in arena.c, on top of the virtual memory primitives in os.h
 
 typedef struct Arena Arena;
+
+typedef struct {
+    bool huge_pages; // Commit in huge page units and ask the OS to back them with huge pages
+    size_t min_commit; // Smallest commit in bytes, rounded up to the page size. Zero picks a default
+    bool decommit_on_reset; // Return idle committed pages to the OS when a scratch is released
+} ArenaDesc;
+
+typedef struct {
+    size_t used;
+    size_t committed;
+
+    size_t pushed; // Total bytes ever pushed, including memory since released by scratches
+    size_t peak_used;
+    size_t peak_committed;
+    size_t peak_scratch; // Most bytes used by a single scratch_get/scratch_release pair
+
+    size_t num_commits;
+    size_t num_decommits;
+} ArenaStats;
+
 Arena* arena_new();
+Arena* arena_new_ex(ArenaDesc desc);
 void arena_destroy(Arena* arena);
 
 void* arena_push(Arena* arena, size_t amount);
 void* arena_zero(Arena* arena, size_t amount);
 
+// Frees everything in the arena but keeps its pages committed, so refilling it does not fault
+void arena_reset(Arena* arena);
+// Decommits whatever lies beyond max(used, keep_committed)
+void arena_trim(Arena* arena, size_t keep_committed);
+
+// Extends the allocation at 'ptr' in place when it is the last thing pushed onto the arena
+bool arena_try_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+ArenaStats arena_stats(Arena* arena);
+void arena_reset_peaks(Arena* arena);
+
+// Sums two sets of stats, e.g. to report several arenas as one. Peaks are summed as well, which
+// bounds the combined peak from above, except peak_scratch which takes the larger of the two.
+ArenaStats arena_stats_combine(ArenaStats a, ArenaStats b);
+
 #define arena_type(arena, type) ((type*)arena_zero(arena, sizeof(type)))
 #define arena_array(arena, type, count) ((type*)arena_zero(arena, (count) * sizeof(type)))
 
 typedef struct {
     Arena* arena;
     size_t save;
+    size_t outer_peak;
 } Scratch;
 
 typedef struct {
     Arena* arenas[2];
 } ScratchLibrary;
 
-inline ScratchLibrary scratch_library_new() {
+static inline ScratchLibrary scratch_library_new() {
     ScratchLibrary lib = {0};
 
     for (int i = 0; i < ARRAY_LENGTH(lib.arenas); ++i) {
-        lib.arenas[i] = arena_new();
+        lib.arenas[i] = arena_new_ex((ArenaDesc) { .decommit_on_reset = true });
     }
 
     return lib;
 }
 
-inline void scratch_library_destroy(ScratchLibrary* lib) {
+static inline void scratch_library_destroy(ScratchLibrary* lib) {
     for (int i = 0; i < ARRAY_LENGTH(lib->arenas); ++i) {
         arena_destroy(lib->arenas[i]);
     }
@@ -48,7 +101,32 @@ inline void scratch_library_destroy(ScratchLibrary* lib) {
 Scratch* scratch_get(ScratchLibrary* lib, int num_conflicts, Arena** conflicts);
 void scratch_release(Scratch* scratch);
 
-inline uint64_t fnv1a(void* data, size_t n) {
+ArenaStats scratch_library_stats(ScratchLibrary* lib);
+void scratch_library_reset_peaks(ScratchLibrary* lib);
+
+// Recycles arenas between compilations. Arenas handed back are reset but stay committed (up to
+// 'retain' bytes each, zero meaning no limit), so the next user starts on warm pages.
+// A pool is not thread safe - give each thread its own.
+typedef struct {
+    ArenaDesc desc;
+    size_t retain;
+
+    int num_free;
+    Arena* free[8];
+} ArenaPool;
+
+ArenaPool arena_pool_new(ArenaDesc desc, size_t retain);
+void arena_pool_destroy(ArenaPool* pool);
+
+Arena* arena_pool_get(ArenaPool* pool);
+void arena_pool_put(ArenaPool* pool, Arena* arena);
+
+// Each thread lazily gets its own library, so passes running on different threads never share
+// scratch arenas. Threads other than the main one should release theirs before exiting.
+ScratchLibrary* get_thread_scratch_library();
+void release_thread_scratch_library();
+
+static inline uint64_t fnv1a(void* data, size_t n) {
     uint64_t hash = 0xcbf29ce484222325; // Offset basis
 
     for (size_t i = 0; i < n; ++i) {
@@ -60,12 +138,105 @@ inline uint64_t fnv1a(void* data, size_t n) {
     return hash;
 }
 
+// Full 64x64 -> 128 bit product
+static inline uint64_t umul128(uint64_t a, uint64_t b, uint64_t* high) {
+    #if defined(_MSC_VER) && defined(_M_X64)
+    return _umul128(a, b, high);
+    #elif defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *high = (uint64_t)(product >> 64);
+    return (uint64_t)product;
+    #else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    *high = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+    return (cross << 32) | (uint32_t)lo_lo;
+    #endif
+}
+
+// Integer mixer for word-sized keys such as pointers: one multiply, then fold the well mixed
+// high half down so the low bits depend on every input bit as well.
+static inline uint64_t hash_u64(uint64_t x) {
+    x *= 0x9e3779b97f4a7c15;
+    return x ^ (x >> 32);
+}
+
+static inline uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+    uint64_t high;
+    uint64_t low = umul128(a, b, &high);
+    return low ^ high;
+}
+
+static inline uint64_t wyhash_read8(uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint64_t wyhash_read4(uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+// Word-at-a-time byte hash, following wyhash (final version 4) with its default secret
+static inline uint64_t hash_bytes(void* data, size_t n) {
+    const uint64_t secret[4] = { 0x2d358dccaa6c78a5, 0x8bb84b93962eacc9, 0x4b33a62ed433d4a3, 0x4d5a2da51de1aa47 };
+
+    uint8_t* p = data;
+    uint64_t seed = wyhash_mix(secret[0], secret[1]);
+    uint64_t a, b;
+
+    if (n <= 16) {
+        if (n >= 4) {
+            size_t mid = (n >> 3) << 2;
+            a = (wyhash_read4(p) << 32) | wyhash_read4(p + mid);
+            b = (wyhash_read4(p + n - 4) << 32) | wyhash_read4(p + n - 4 - mid);
+        }
+        else if (n > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t i = n;
+
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+
+            do {
+                seed = wyhash_mix(wyhash_read8(p) ^ secret[1], wyhash_read8(p + 8) ^ seed);
+                see1 = wyhash_mix(wyhash_read8(p + 16) ^ secret[2], wyhash_read8(p + 24) ^ see1);
+                see2 = wyhash_mix(wyhash_read8(p + 32) ^ secret[3], wyhash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = wyhash_mix(wyhash_read8(p) ^ secret[1], wyhash_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = wyhash_read8(p + i - 16);
+        b = wyhash_read8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    a = umul128(a, b, &b);
+
+    return wyhash_mix(a ^ secret[0] ^ n, b ^ secret[1]);
+}
+
 typedef struct {
     size_t num_bits;
     uint64_t* words;
 } Bitset;
 
-inline Bitset* bitset_alloc(Arena* arena, size_t num_bits) {
+static inline Bitset* bitset_alloc(Arena* arena, size_t num_bits) {
     Bitset* set = arena_type(arena, Bitset);
     set->num_bits = num_bits;
     size_t num_words = (num_bits + 63) / 64;
@@ -73,34 +244,229 @@ inline Bitset* bitset_alloc(Arena* arena, size_t num_bits) {
     return set;
 }
 
-inline bool bitset_get(Bitset* set, size_t index) {
+static inline bool bitset_get(Bitset* set, size_t index) {
     assert(index < set->num_bits);
     return (set->words[index/64] >> (index % 64)) & 1;
 }
 
-inline void bitset_set(Bitset* set, size_t index) {
+static inline void bitset_set(Bitset* set, size_t index) {
     assert(index < set->num_bits);
     set->words[index/64] |= ((uint64_t)1<< (index % 64));
 }
 
-inline void bitset_unset(Bitset* set, size_t index) {
+static inline void bitset_unset(Bitset* set, size_t index) {
     assert(index < set->num_bits);
     set->words[index/64] &= ~((uint64_t)1 << (index % 64));
 }
 
+static inline int count_trailing_zeros64(uint64_t x) {
+    assert(x);
+    #if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+    #else
+    return __builtin_ctzll(x);
+    #endif
+}
+
+static inline int popcount64(uint64_t x) {
+    #if defined(_MSC_VER)
+    return (int)__popcnt64(x);
+    #else
+    return __builtin_popcountll(x);
+    #endif
+}
+
+static inline size_t bitset_num_words(Bitset* set) {
+    return (set->num_bits + 63) / 64;
+}
+
+// Bits past num_bits in the last word are always kept zero, so counting and comparing can
+// work on whole words
+
+static inline void bitset_clear(Bitset* set) {
+    memset(set->words, 0, bitset_num_words(set) * sizeof(uint64_t));
+}
+
+static inline void bitset_fill(Bitset* set) {
+    size_t num_words = bitset_num_words(set);
+    memset(set->words, 0xff, num_words * sizeof(uint64_t));
+
+    if (set->num_bits % 64) {
+        set->words[num_words-1] = ((uint64_t)1 << (set->num_bits % 64)) - 1;
+    }
+}
+
+static inline void bitset_copy(Bitset* dst, Bitset* src) {
+    assert(dst->num_bits == src->num_bits);
+    memcpy(dst->words, src->words, bitset_num_words(dst) * sizeof(uint64_t));
+}
+
+static inline bool bitset_equal(Bitset* a, Bitset* b) {
+    assert(a->num_bits == b->num_bits);
+    return memcmp(a->words, b->words, bitset_num_words(a) * sizeof(uint64_t)) == 0;
+}
+
+typedef enum {
+    BITSET_UNION,
+    BITSET_INTERSECT,
+    BITSET_DIFFERENCE,
+} BitsetOp;
+
+static inline uint64_t bitset_op_word(BitsetOp op, uint64_t a, uint64_t b) {
+    switch (op) {
+        case BITSET_UNION:
+            return a | b;
+        case BITSET_INTERSECT:
+            return a & b;
+        case BITSET_DIFFERENCE:
+            return a & ~b;
+    }
+
+    assert(false);
+    return 0;
+}
+
+#if HAVE_AVX2
+static inline __m256i bitset_op_avx2(BitsetOp op, __m256i a, __m256i b) {
+    switch (op) {
+        case BITSET_UNION:
+            return _mm256_or_si256(a, b);
+        case BITSET_INTERSECT:
+            return _mm256_and_si256(a, b);
+        case BITSET_DIFFERENCE:
+            return _mm256_andnot_si256(b, a);
+    }
+
+    assert(false);
+    return _mm256_setzero_si256();
+}
+#elif HAVE_SSE2
+static inline __m128i bitset_op_sse2(BitsetOp op, __m128i a, __m128i b) {
+    switch (op) {
+        case BITSET_UNION:
+            return _mm_or_si128(a, b);
+        case BITSET_INTERSECT:
+            return _mm_and_si128(a, b);
+        case BITSET_DIFFERENCE:
+            return _mm_andnot_si128(b, a);
+    }
+
+    assert(false);
+    return _mm_setzero_si128();
+}
+#endif
+
+// dst = dst op src, returning whether dst changed, which is what a dataflow fixpoint loop
+// checks. 'op' is a constant at every call site, so the switches fold away once inlined.
+static inline bool bitset_combine(Bitset* dst, Bitset* src, BitsetOp op) {
+    assert(dst->num_bits == src->num_bits);
+
+    size_t num_words = bitset_num_words(dst);
+    uint64_t* d = dst->words;
+    uint64_t* s = src->words;
+
+    size_t i = 0;
+    bool changed = false;
+
+    #if HAVE_AVX2
+    __m256i diff = _mm256_setzero_si256();
+
+    for (; i + 4 <= num_words; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*)(d + i));
+        __m256i r = bitset_op_avx2(op, a, _mm256_loadu_si256((__m256i*)(s + i)));
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(a, r));
+        _mm256_storeu_si256((__m256i*)(d + i), r);
+    }
+
+    changed = !_mm256_testz_si256(diff, diff);
+    #elif HAVE_SSE2
+    __m128i diff = _mm_setzero_si128();
+
+    for (; i + 2 <= num_words; i += 2) {
+        __m128i a = _mm_loadu_si128((__m128i*)(d + i));
+        __m128i r = bitset_op_sse2(op, a, _mm_loadu_si128((__m128i*)(s + i)));
+        diff = _mm_or_si128(diff, _mm_xor_si128(a, r));
+        _mm_storeu_si128((__m128i*)(d + i), r);
+    }
+
+    changed = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff;
+    #endif
+
+    uint64_t tail_diff = 0;
+
+    for (; i < num_words; ++i) {
+        uint64_t r = bitset_op_word(op, d[i], s[i]);
+        tail_diff |= d[i] ^ r;
+        d[i] = r;
+    }
+
+    return changed || tail_diff;
+}
+
+static inline bool bitset_union(Bitset* dst, Bitset* src) {
+    return bitset_combine(dst, src, BITSET_UNION);
+}
+
+static inline bool bitset_intersect(Bitset* dst, Bitset* src) {
+    return bitset_combine(dst, src, BITSET_INTERSECT);
+}
+
+static inline bool bitset_difference(Bitset* dst, Bitset* src) {
+    return bitset_combine(dst, src, BITSET_DIFFERENCE);
+}
+
+static inline size_t bitset_count(Bitset* set) {
+    size_t num_words = bitset_num_words(set);
+    size_t count = 0;
+
+    for (size_t i = 0; i < num_words; ++i) {
+        count += popcount64(set->words[i]);
+    }
+
+    return count;
+}
+
+// Index of the first set bit at or after 'from', or num_bits if there is none. Iterate with
+//   for (size_t i = bitset_find_first(set); i < set->num_bits; i = bitset_find_next(set, i + 1))
+static inline size_t bitset_find_next(Bitset* set, size_t from) {
+    if (from >= set->num_bits) {
+        return set->num_bits;
+    }
+
+    size_t num_words = bitset_num_words(set);
+    size_t w = from / 64;
+    uint64_t word = set->words[w] & (~(uint64_t)0 << (from % 64));
+
+    while (!word) {
+        if (++w == num_words) {
+            return set->num_bits;
+        }
+
+        word = set->words[w];
+    }
+
+    return w * 64 + count_trailing_zeros64(word);
+}
+
+static inline size_t bitset_find_first(Bitset* set) {
+    return bitset_find_next(set, 0);
+}
+
 typedef struct {
     char* str;
     size_t length;
 } String;
 
-inline String view_cstr(char* str) {
+static inline String view_cstr(char* str) {
     return (String) {
         .length = strlen(str),
         .str = str
     };
 }
 
-inline String clone_cstr(Arena* arena, char* str) {
+static inline String clone_cstr(Arena* arena, char* str) {
     size_t len = strlen(str);
 
     char* buf = arena_push(arena, len + 1);
@@ -112,4 +478,21 @@ inline String clone_cstr(Arena* arena, char* str) {
         .str = str,
         .length = len
     };
-}
\ No newline at end of file
+}
+// Defined in output.c. Text is appended into an arena and written out in one go, which keeps
+// large dumps from paying a call into the C runtime per token.
+
+typedef struct {
+    Arena* arena;
+    char* data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+OutputBuffer output_new(Arena* arena);
+
+void output_write(OutputBuffer* out, const char* str, size_t length);
+void output_printf(OutputBuffer* out, const char* format, ...);
+
+// Writes everything appended so far and empties the buffer
+void output_flush(OutputBuffer* out, FILE* file);
@@ -101,6 +101,4 @@ void report_error_token(char* source, char* source_path, Token token, char* fmt,
 void hir_append(HIR_Block* block, HIR_Node* node);
 void hir_print(HIR_Proc* proc, char* name);
 
-SB_Proc* hir_lower(SB_Context* ctx, HIR_Proc* hir_proc);
-
-ScratchLibrary* get_global_scratch_library();
\ No newline at end of file
+SB_Proc* hir_lower(SB_Context* ctx, HIR_Proc* hir_proc);
\ No newline at end of file
@@ -2,14 +2,13 @@
 #include <stdio.h>
 
 #include "containers.h"
+#include "swiss.h"
 
 #define INVALID_INDEX 0xffffffffffffffff
 
-enum {
-    EMPTY,
-    OCCUPIED,
-    REMOVED,
-};
+// Open addressing in the style of SwissTable, see swiss.h. This is the untyped version, where the
+// hash and compare go through function pointers and keys are copied by size. The typed maps
+// generated by hash_map.inc share the same layout and policy.
 
 static void* get_key(HashSet* set, size_t i) {
     return (uint8_t*)set->keys + i * set->key_size;
@@ -28,94 +27,122 @@ HashSet hash_set_new(size_t key_size, ContainerHashFn hash_fn, ContainerCmpFn cm
 }
 
 void hash_set_destroy(HashSet* set) {
-    free(set->states);
+    free(set->ctrl);
     free(set->keys);
 }
 
-static float load_factor(size_t used, size_t capacity) {
-    return (float)used/(float)capacity;
-}
+static size_t find_hashed(HashSet* set, void* key, uint64_t hash) {
+    if (!set->capacity) {
+        return INVALID_INDEX;
+    }
 
-static size_t insert_key(HashSet* set, void* key) {
-    uint64_t hash = set->hash_fn(key);
-    size_t i = hash % set->capacity;
+    uint8_t tag = hash_tag(hash);
+    Probe probe = probe_start(set->capacity, hash);
+
+    while (probe.step <= probe.mask) {
+        uint8_t* group = set->ctrl + probe.group * GROUP_SIZE;
 
-    for (size_t j = 0; j < set->capacity; ++j) {
-        void* cur = get_key(set, i);
+        for (GroupMask m = group_match(group, tag); m; m &= m - 1) {
+            size_t i = probe.group * GROUP_SIZE + lowest_bit(m);
 
-        switch (set->states[i]) {
-            case EMPTY:
-                set->used++;
-            case REMOVED:
-                set->states[i] = OCCUPIED;
-                memcpy(cur, key, set->key_size);
+            if (set->cmp_fn(get_key(set, i), key)) {
                 return i;
-            case OCCUPIED:
-                if (set->cmp_fn(cur, key)) { return i; }
-                break;
+            }
         }
-        
-        i = (i + 1) % set->capacity;
+
+        if (group_match(group, CTRL_EMPTY)) {
+            return INVALID_INDEX;
+        }
+
+        probe_next(&probe);
     }
 
-    assert(false);
-    return 0xffffffff;
+    return INVALID_INDEX;
 }
 
-static HashSet resized(HashSet* set) {
-    HashSet new_set = hash_set_new(set->key_size, set->hash_fn, set->cmp_fn);
-    new_set.capacity = set->capacity ? set->capacity * 2 : 8;
-    new_set.keys = calloc(new_set.capacity, set->key_size);
-    new_set.states = calloc(new_set.capacity, sizeof(uint8_t));
-    return new_set;
+static size_t find(HashSet* set, void* key) {
+    if (!set->capacity) {
+        return INVALID_INDEX;
+    }
+
+    return find_hashed(set, key, set->hash_fn(key));
 }
 
-static bool require_resize(HashSet* set) {
-    return !set->capacity || load_factor(set->used, set->capacity) > 0.5f;
+static size_t find_free(HashSet* set, uint64_t hash) {
+    return probe_free(set->ctrl, set->capacity, hash);
 }
 
-void hash_set_insert(HashSet* set, void* key) {
-    if (require_resize(set))
-    {
-        HashSet new_set = resized(set);
-
-        for (size_t i = 0; i < set->capacity; ++i) {
-            if (set->states[i] == OCCUPIED)
-            {
-                void* cur = get_key(set, i);
-                insert_key(&new_set, cur);
-            }
-        }
+static void rehash(HashSet* set, void** values, size_t value_size) {
+    size_t new_capacity = rehash_capacity(set->capacity, set->used);
 
-        hash_set_destroy(set);
-        memcpy(set, &new_set, sizeof(new_set));
+    HashSet new_set = hash_set_new(set->key_size, set->hash_fn, set->cmp_fn);
+    new_set.capacity = new_capacity;
+    new_set.used = set->used;
+    new_set.growth_left = max_load(new_capacity) - set->used;
+    new_set.keys = malloc(new_capacity * set->key_size);
+    new_set.ctrl = malloc(new_capacity);
+    memset(new_set.ctrl, CTRL_EMPTY, new_capacity);
+
+    void* new_values = values ? malloc(new_capacity * value_size) : 0;
+
+    for (size_t i = 0; i < set->capacity; ++i) {
+        if (set->ctrl[i] & 0x80) { continue; }
+
+        void* key = get_key(set, i);
+        uint64_t hash = set->hash_fn(key);
+        size_t j = find_free(&new_set, hash);
+
+        new_set.ctrl[j] = hash_tag(hash);
+        memcpy(get_key(&new_set, j), key, set->key_size);
+
+        if (values) {
+            memcpy(get_value(new_values, value_size, j), get_value(*values, value_size, i), value_size);
+        }
     }
 
-    insert_key(set, key);
+    hash_set_destroy(set);
+    *set = new_set;
+
+    if (values) {
+        free(*values);
+        *values = new_values;
+    }
 }
 
-static size_t find(HashSet* set, void* key) {
+// Returns the slot holding 'key', claiming one if it is not present yet. Values live in a
+// separate array indexed by slot, which moves along with the keys when the table grows.
+static size_t insert_key(HashSet* set, void** values, size_t value_size, void* key) {
+    uint64_t hash = set->hash_fn(key);
+
+    size_t i = find_hashed(set, key, hash);
+    if (i != INVALID_INDEX) {
+        return i;
+    }
+
     if (!set->capacity) {
-        return INVALID_INDEX;
+        rehash(set, values, value_size);
     }
 
-    size_t i = set->hash_fn(key) % set->capacity;
-
-    for (size_t j = 0; j < set->capacity; ++j) {
-        switch (set->states[i]) {
-            case EMPTY:
-                return INVALID_INDEX;
-            case OCCUPIED: {
-                void* cur = get_key(set, i);
-                if (set->cmp_fn(cur, key)) {
-                    return i;
-                }
-            } break;
-        }
-        i = (i+1) % set->capacity;
+    i = find_free(set, hash);
+
+    if (set->ctrl[i] == CTRL_EMPTY && !set->growth_left) {
+        rehash(set, values, value_size);
+        i = find_free(set, hash);
     }
 
-    return INVALID_INDEX;
+    if (set->ctrl[i] == CTRL_EMPTY) {
+        set->growth_left--;
+    }
+
+    set->ctrl[i] = hash_tag(hash);
+    memcpy(get_key(set, i), key, set->key_size);
+    set->used++;
+
+    return i;
+}
+
+void hash_set_insert(HashSet* set, void* key) {
+    insert_key(set, 0, 0, key);
 }
 
 bool hash_set_contains(HashSet* set, void* key) {
@@ -125,9 +152,12 @@ bool hash_set_contains(HashSet* set, void* key) {
 void hash_set_remove(HashSet* set, void* key) {
     size_t index = find(set, key);
 
-    if (index != INVALID_INDEX) {
-        set->states[index] = REMOVED;
+    if (index == INVALID_INDEX) {
+        return;
     }
+
+    ctrl_erase(set->ctrl, index, &set->growth_left);
+    set->used--;
 }
 
 HashMap hash_map_new(size_t key_size, size_t value_size, ContainerHashFn hash_fn, ContainerCmpFn cmp_fn) {
@@ -142,35 +172,9 @@ void hash_map_destroy(HashMap* map) {
     free(map->values);
 }
 
-static void insert_pair(HashSet* set, void* values, size_t value_size, void* key, void* value) {
-    size_t idx = insert_key(set, key);
-    void* dest = get_value(values, value_size, idx);
-    memcpy(dest, value, value_size);
-}
-
 void hash_map_insert(HashMap* map, void* key, void* value) {
-    if (require_resize(&map->set))
-    {
-        HashSet new_set = resized(&map->set);
-        void* new_values = malloc(map->value_size * new_set.capacity);
-
-        for (size_t i = 0; i < map->set.capacity; ++i) {
-            if (map->set.states[i] == OCCUPIED)
-            {
-                void* cur_key = get_key(&map->set, i);
-                void* cur_value = get_value(map->values, map->value_size, i);
-                insert_pair(&new_set, new_values, map->value_size, cur_key, cur_value);
-            }
-        }
-
-        hash_set_destroy(&map->set);
-        free(map->values);
-
-        map->set = new_set;
-        map->values = new_values;
-    }
-
-    insert_pair(&map->set, map->values, map->value_size, key, value);
+    size_t idx = insert_key(&map->set, &map->values, map->value_size, key);
+    memcpy(get_value(map->values, map->value_size, idx), value, map->value_size);
 }
 
 bool hash_map_contains(HashMap* map, void* key) {
@@ -185,4 +189,4 @@ void* hash_map_get(HashMap* map, void* key) {
     size_t idx = find(&map->set, key);
     assert("key does not exist in hash map" && idx != INVALID_INDEX);
     return get_value(map->values, map->value_size, idx);
-}
\ No newline at end of file
+}
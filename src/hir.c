@@ -54,15 +54,18 @@ static BlockNodeCount assign_tids(HIR_Proc* proc) {
 }
 
 void hir_print(HIR_Proc* proc, char* name) {
-    printf("-- proc %s --\n", name);
+    Scratch* scratch = scratch_get(get_thread_scratch_library(), 0, 0);
+    OutputBuffer out = output_new(scratch->arena);
+
+    output_printf(&out, "-- proc %s --\n", name);
 
     assign_tids(proc);
 
     foreach_block(block, proc) {
-        printf("bb_%d:\n", block->tid);
+        output_printf(&out, "bb_%d:\n", block->tid);
 
         foreach_node(n, block) {
-            printf("  %%%-3d = ", n->tid);
+            output_printf(&out, "  %%%-3d = ", n->tid);
 
             static_assert(NUM_HIR_OPS == 12, "handle print ops");
             switch (n->op) {
@@ -70,48 +73,51 @@ void hir_print(HIR_Proc* proc, char* name) {
                     assert(false);
                     break;
                 case HIR_OP_INT_CONST:
-                    printf("$%lld", n->as.int_const.low);
+                    output_printf(&out, "$%lld", n->as.int_const.low);
                     break;
                 case HIR_OP_ADD:
-                    printf("add %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
+                    output_printf(&out, "add %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
                     break;                                  
                 case HIR_OP_SUB:                            
-                    printf("sub %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
+                    output_printf(&out, "sub %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
                     break;                                  
                 case HIR_OP_MUL:                            
-                    printf("mul %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
+                    output_printf(&out, "mul %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
                     break;                                  
                 case HIR_OP_DIV:                            
-                    printf("div %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
+                    output_printf(&out, "div %%%d, %%%d", n->as.binary[0]->tid, n->as.binary[1]->tid);
                     break;
                 case HIR_OP_ASSIGN:
-                    printf("assign [%%%d], %%%d", n->as.assign.addr->tid, n->as.assign.value->tid);
+                    output_printf(&out, "assign [%%%d], %%%d", n->as.assign.addr->tid, n->as.assign.value->tid);
                     break;
                 case HIR_OP_LOAD:
-                    printf("load %%%d", n->as.load.addr->tid);
+                    output_printf(&out, "load %%%d", n->as.load.addr->tid);
                     break;
                 case HIR_OP_JUMP:
-                    printf("jmp bb_%d", n->as.jump.loc->tid);
+                    output_printf(&out, "jmp bb_%d", n->as.jump.loc->tid);
                     break;
                 case HIR_OP_BRANCH:
-                    printf("branch %%%d <bb_%d, bb_%d>", n->as.branch.predicate->tid, n->as.branch.loc_then->tid, n->as.branch.loc_else->tid);
+                    output_printf(&out, "branch %%%d <bb_%d, bb_%d>", n->as.branch.predicate->tid, n->as.branch.loc_then->tid, n->as.branch.loc_else->tid);
                     break;
                 case HIR_OP_RET:
-                    printf("ret");
+                    output_printf(&out, "ret");
                     if (n->as.ret.value) {
-                        printf(" %%%d", n->as.ret.value->tid);
+                        output_printf(&out, " %%%d", n->as.ret.value->tid);
                     }
                     break;
                 case HIR_OP_LOCAL:
-                    printf("local");
+                    output_printf(&out, "local");
                     break;
             }
 
-            printf("\n");
+            output_printf(&out, "\n");
         }
     }
 
-    printf("\n");
+    output_printf(&out, "\n");
+    output_flush(&out, stdout);
+
+    scratch_release(scratch);
 }
 
 typedef struct {
@@ -140,7 +146,7 @@ static Successors get_successors(HIR_Block* block) {
 static Bitset* walk_cfg(Arena* arena, HIR_Proc* proc, int num_blocks) {
     Bitset* reachable = bitset_alloc(arena, num_blocks);
 
-    Vec(HIR_Block*) stack = 0;
+    Vec(HIR_Block*) stack = vec_new(arena, HIR_Block*, num_blocks);
     vec_push(stack, proc->control_flow_head);
     
     while (vec_len(stack)) {
@@ -155,8 +161,6 @@ static Bitset* walk_cfg(Arena* arena, HIR_Proc* proc, int num_blocks) {
         }
     }
 
-    vec_destroy(stack);
-
     return reachable;
 }
 
@@ -219,7 +223,7 @@ static SB_Node* lower_node(SB_Context* ctx, SB_Node** conv, State* state, SB_Nod
 }
 
 SB_Proc* hir_lower(SB_Context* ctx, HIR_Proc* hir_proc) {
-    Scratch* scratch = scratch_get(get_global_scratch_library(), 0, 0);
+    Scratch* scratch = scratch_get(get_thread_scratch_library(), 0, 0);
 
     BlockNodeCount bnc = assign_tids(hir_proc);
     Bitset* reachable = walk_cfg(scratch->arena, hir_proc, bnc.num_blocks);
@@ -234,13 +238,19 @@ SB_Proc* hir_lower(SB_Context* ctx, HIR_Proc* hir_proc) {
         heads[block->tid] = (BlockHead) {
             .region = sb_node_region(ctx),
             .mem_phi = sb_node_phi(ctx),
+            .ctrl_ins = vec_new(scratch->arena, SB_Node*, 2),
+            .mem_ins = vec_new(scratch->arena, SB_Node*, 2),
         };
     }
 
     // Generate the graph for each basic block
 
     SB_Node** conv = arena_array(scratch->arena, SB_Node*, bnc.num_nodes); // Convert HIR_Node to SB_Node
-    EndPaths end_paths = {0}; // Stores each return pathway
+    EndPaths end_paths = { // Stores each return pathway
+        .ctrl = vec_new(scratch->arena, SB_Node*, 0),
+        .mem = vec_new(scratch->arena, SB_Node*, 0),
+        .ret_val = vec_new(scratch->arena, SB_Node*, 0),
+    };
 
     foreach_block(block, hir_proc) {
         if (!bitset_get(reachable, block->tid)) { continue; }
@@ -297,9 +307,6 @@ SB_Proc* hir_lower(SB_Context* ctx, HIR_Proc* hir_proc) {
 
         sb_provide_region_inputs(ctx, h->region, (int)vec_len(h->ctrl_ins), h->ctrl_ins);
         sb_provide_phi_inputs(ctx, h->mem_phi, h->region, (int)vec_len(h->mem_ins), h->mem_ins);
-
-        vec_destroy(h->ctrl_ins);
-        vec_destroy(h->mem_ins);
     }
 
     // Construct join-nodes for end node
@@ -314,10 +321,6 @@ SB_Proc* hir_lower(SB_Context* ctx, HIR_Proc* hir_proc) {
     sb_provide_phi_inputs(ctx, end_mem_phi, end_region, (int)vec_len(end_paths.mem), end_paths.mem);
     sb_provide_phi_inputs(ctx, end_ret_val_phi, end_region, (int)vec_len(end_paths.ret_val), end_paths.ret_val);
 
-    vec_destroy(end_paths.ctrl);
-    vec_destroy(end_paths.mem);
-    vec_destroy(end_paths.ret_val);
-
     // Make proc
 
     SB_Node* end = sb_node_end(ctx, end_region, end_mem_phi, end_ret_val_phi);
@@ -1,24 +1,163 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "frontend.h"
 #include "containers.h"
+#include "os.h"
 
-static ScratchLibrary scratch_library;
+typedef enum {
+    MEM_STATS_NONE,
+    MEM_STATS_TEXT,
+    MEM_STATS_JSON,
+} MemStatsFormat;
 
-ScratchLibrary* get_global_scratch_library() {
-    return &scratch_library;
+// Debug output, off unless asked for with --dump-hir / --dump-graph
+typedef enum {
+    DUMP_NONE = 0,
+    DUMP_HIR = 1 << 0,
+    DUMP_GRAPH = 1 << 1,
+} DumpFlags;
+
+// --save-ir writes the optimized IR of 'file.bs' to 'file.bs.sbir', which can be passed back in
+// place of the source
+#define IR_EXTENSION ".sbir"
+
+typedef struct {
+    DumpFlags dumps;
+    bool save_ir;
+
+    SB_OptLevel opt_level;
+    char* pipeline; // From --passes, runs instead of the opt level's pipeline. --save-ir needs it to end in compact
+} Options;
+
+typedef enum {
+    PHASE_PARSE,
+    PHASE_LOWER,
+    PHASE_OPT,
+    PHASE_CODEGEN,
+    NUM_PHASES,
+} Phase;
+
+static char* phase_names[NUM_PHASES] = {
+    [PHASE_PARSE] = "parse",
+    [PHASE_LOWER] = "lower",
+    [PHASE_OPT] = "opt",
+    [PHASE_CODEGEN] = "codegen",
+};
+
+// Totals for one phase, accumulated over every file compiled
+typedef struct {
+    ArenaStats before;
+
+    size_t pushed;
+    long long committed_delta;
+    size_t peak_used;
+    size_t peak_committed;
+    size_t peak_scratch;
+    size_t num_commits;
+    size_t num_decommits;
+} PhaseMemory;
+
+typedef struct {
+    Arena* arena; // Frontend arena of the file being compiled, if any
+    SB_Context* sbc;
+
+    PhaseMemory phases[NUM_PHASES];
+} MemoryReport;
+
+static ArenaStats memory_snapshot(MemoryReport* report) {
+    ArenaStats stats = scratch_library_stats(get_thread_scratch_library());
+    stats = arena_stats_combine(stats, sb_memory_stats(report->sbc));
+
+    if (report->arena) {
+        stats = arena_stats_combine(stats, arena_stats(report->arena));
+    }
+
+    return stats;
+}
+
+static void phase_begin(MemoryReport* report, Phase phase) {
+    if (report->arena) {
+        arena_reset_peaks(report->arena);
+    }
+
+    scratch_library_reset_peaks(get_thread_scratch_library());
+    sb_reset_memory_peaks(report->sbc);
+
+    report->phases[phase].before = memory_snapshot(report);
+}
+
+static size_t max_size(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+static void phase_end(MemoryReport* report, Phase phase) {
+    PhaseMemory* p = &report->phases[phase];
+    ArenaStats after = memory_snapshot(report);
+
+    p->pushed += after.pushed - p->before.pushed;
+    p->committed_delta += (long long)after.committed - (long long)p->before.committed;
+    p->peak_used = max_size(p->peak_used, after.peak_used);
+    p->peak_committed = max_size(p->peak_committed, after.peak_committed);
+    p->peak_scratch = max_size(p->peak_scratch, after.peak_scratch);
+    p->num_commits += after.num_commits - p->before.num_commits;
+    p->num_decommits += after.num_decommits - p->before.num_decommits;
 }
 
-int main() {
-    Arena* arena = arena_new();
-    scratch_library = scratch_library_new();
-    
-    char* source_path = "examples/test.bs";
+static void print_memory_report(MemoryReport* report, MemStatsFormat format) {
+    ArenaStats final = memory_snapshot(report);
+
+    switch (format) {
+        case MEM_STATS_NONE:
+            break;
+
+        case MEM_STATS_TEXT:
+            printf("-- memory (KiB) --\n");
+            printf("%-10s %12s %12s %12s %12s %12s %8s\n", "phase", "pushed", "+committed", "peak used", "peak commit", "peak scratch", "commits");
+
+            for (int i = 0; i < NUM_PHASES; ++i) {
+                PhaseMemory* p = &report->phases[i];
+                printf("%-10s %12zu %12lld %12zu %12zu %12zu %8zu\n",
+                    phase_names[i],
+                    p->pushed / 1024,
+                    p->committed_delta / 1024,
+                    p->peak_used / 1024,
+                    p->peak_committed / 1024,
+                    p->peak_scratch / 1024,
+                    p->num_commits);
+            }
+
+            printf("%-10s %12zu %12s %12s %12zu %12s %8zu\n\n", "total", final.pushed / 1024, "", "", final.committed / 1024, "", final.num_commits);
+            break;
+
+        case MEM_STATS_JSON:
+            printf("{\"phases\":[");
+
+            for (int i = 0; i < NUM_PHASES; ++i) {
+                PhaseMemory* p = &report->phases[i];
+                printf("%s{\"name\":\"%s\",\"pushed\":%zu,\"committed_delta\":%lld,\"peak_used\":%zu,\"peak_committed\":%zu,\"peak_scratch\":%zu,\"commits\":%zu,\"decommits\":%zu}",
+                    i ? "," : "",
+                    phase_names[i],
+                    p->pushed,
+                    p->committed_delta,
+                    p->peak_used,
+                    p->peak_committed,
+                    p->peak_scratch,
+                    p->num_commits,
+                    p->num_decommits);
+            }
+
+            printf("],\"total\":{\"pushed\":%zu,\"used\":%zu,\"committed\":%zu,\"commits\":%zu,\"decommits\":%zu}}\n",
+                final.pushed, final.used, final.committed, final.num_commits, final.num_decommits);
+            break;
+    }
+}
 
-    FILE* file;
-    if (fopen_s(&file, source_path, "r")) {
+static char* read_source(Arena* arena, char* source_path) {
+    FILE* file = os_open_file(source_path, "r");
+    if (!file) {
         printf("Failed to read '%s'\n", source_path);
-        return 1;
+        return 0;
     }
 
     fseek(file, 0, SEEK_END);
@@ -29,17 +168,186 @@ int main() {
     size_t source_length = fread(source, 1, file_length, file);
     source[source_length] = '\0';
 
-    HIR_Proc* proc = parse_source(arena, source, source_path);
-    if (!proc) { return 1; }
-    
-    hir_print(proc, "main");
+    fclose(file);
+
+    return source;
+}
+
+static void generate_code(MemoryReport* report, Options* options, SB_Proc* proc) {
+    SB_Context* sbc = report->sbc;
+
+    if (options->dumps & DUMP_GRAPH) {
+        sb_graphviz(sbc, proc);
+    }
+
+    phase_begin(report, PHASE_CODEGEN);
+    sb_generate_win64(sbc, proc);
+    phase_end(report, PHASE_CODEGEN);
+
+    sb_reset(sbc);
+}
+
+// Each phase's memory is dropped as soon as the next one no longer needs it: the frontend arena
+// (source text and HIR) goes back to the pool right after lowering, and the SB context is reset
+// after codegen. Both keep their pages committed for the next file.
+static bool compile_file(MemoryReport* report, ArenaPool* pool, Options* options, char* source_path) {
+    SB_Context* sbc = report->sbc;
+    Arena* arena = arena_pool_get(pool);
+    report->arena = arena;
+
+    phase_begin(report, PHASE_PARSE);
 
-    SB_Context* sbc = sb_init();
+    char* source = read_source(arena, source_path);
+    HIR_Proc* proc = source ? parse_source(arena, source, source_path) : 0;
+
+    phase_end(report, PHASE_PARSE);
+
+    if (!proc) {
+        report->arena = 0;
+        arena_pool_put(pool, arena);
+        return false;
+    }
+
+    if (options->dumps & DUMP_HIR) {
+        hir_print(proc, "main");
+    }
+
+    phase_begin(report, PHASE_LOWER);
     SB_Proc* ll_proc = hir_lower(sbc, proc);
-    sb_opt(sbc, ll_proc);
+    phase_end(report, PHASE_LOWER);
+
+    report->arena = 0;
+    arena_pool_put(pool, arena);
+
+    phase_begin(report, PHASE_OPT);
+    if (options->pipeline) {
+        ll_proc = sb_run_pipeline(sbc, ll_proc, options->pipeline);
+    }
+    else {
+        ll_proc = sb_optimize(sbc, ll_proc, options->opt_level);
+    }
+    phase_end(report, PHASE_OPT);
+
+    bool saved = true;
+
+    if (options->save_ir) {
+        char ir_path[1024];
+        snprintf(ir_path, sizeof(ir_path), "%s%s", source_path, IR_EXTENSION);
+
+        if (!sb_write_proc(sbc, ll_proc, ir_path)) {
+            printf("Failed to write '%s'\n", ir_path);
+            saved = false;
+        }
+    }
+
+    generate_code(report, options, ll_proc);
+
+    return saved;
+}
+
+static bool is_ir_path(char* path) {
+    size_t length = strlen(path);
+    size_t ext_length = strlen(IR_EXTENSION);
+    return length >= ext_length && strcmp(path + length - ext_length, IR_EXTENSION) == 0;
+}
+
+// Optimized IR cached by --save-ir goes straight to codegen
+static bool compile_ir_file(MemoryReport* report, Options* options, char* ir_path) {
+    phase_begin(report, PHASE_PARSE);
+    SB_Proc* proc = sb_read_proc(report->sbc, ir_path);
+    phase_end(report, PHASE_PARSE);
+
+    if (!proc) {
+        printf("Failed to load '%s'\n", ir_path);
+        return false;
+    }
+
+    generate_code(report, options, proc);
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    MemStatsFormat mem_stats = MEM_STATS_NONE;
+
+    Options options = {
+        .opt_level = SB_OPT_LEVEL_1,
+    };
+
+    int num_paths = 0;
+    char** source_paths = argv + 1; // Positional arguments are compacted to the front
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats = MEM_STATS_TEXT;
+        }
+        else if (strcmp(argv[i], "--mem-stats=json") == 0) {
+            mem_stats = MEM_STATS_JSON;
+        }
+        else if (strcmp(argv[i], "--dump-hir") == 0) {
+            options.dumps |= DUMP_HIR;
+        }
+        else if (strcmp(argv[i], "--dump-graph") == 0) {
+            options.dumps |= DUMP_GRAPH;
+        }
+        else if (strcmp(argv[i], "--save-ir") == 0) {
+            options.save_ir = true;
+        }
+        else if (strcmp(argv[i], "-O0") == 0) {
+            options.opt_level = SB_OPT_LEVEL_0;
+        }
+        else if (strcmp(argv[i], "-O1") == 0) {
+            options.opt_level = SB_OPT_LEVEL_1;
+        }
+        else if (strcmp(argv[i], "-O2") == 0) {
+            options.opt_level = SB_OPT_LEVEL_2;
+        }
+        else if (strncmp(argv[i], "--passes=", 9) == 0) {
+            options.pipeline = argv[i] + 9;
+
+            if (!sb_valid_pipeline(options.pipeline)) {
+                printf("Unknown pass in '%s'\n", options.pipeline);
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            printf("Unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+        else {
+            source_paths[num_paths++] = argv[i];
+        }
+    }
+
+    char* default_path = "examples/test.bs";
+
+    if (!num_paths) {
+        source_paths = &default_path;
+        num_paths = 1;
+    }
+
+    ArenaPool pool = arena_pool_new((ArenaDesc) {0}, 16 * 1024 * 1024);
+
+    MemoryReport report = {
+        .sbc = sb_init(),
+    };
+
+    int result = 0;
+
+    for (int i = 0; i < num_paths; ++i) {
+        bool ok = is_ir_path(source_paths[i])
+            ? compile_ir_file(&report, &options, source_paths[i])
+            : compile_file(&report, &pool, &options, source_paths[i]);
+
+        if (!ok) {
+            result = 1;
+        }
+    }
+
+    print_memory_report(&report, mem_stats);
 
-    sb_graphviz(ll_proc);
-    sb_generate_win64(sbc, ll_proc);
+    sb_cleanup(report.sbc);
+    arena_pool_destroy(&pool);
 
-    return 0;
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "core.h"
+
+// Virtual memory primitives. Defined in os file
+
+size_t os_page_size();
+size_t os_huge_page_size();
+
+// Reserves address space without backing it. The result is aligned to 'alignment' (a power of two).
+// With 'huge_pages' set, the OS is asked to back committed ranges with huge pages where it can.
+void* os_reserve(size_t size, size_t alignment, bool huge_pages);
+void os_release(void* base, size_t size);
+
+bool os_commit(void* ptr, size_t size);
+void os_decommit(void* ptr, size_t size);
+
+// Monotonic clock for timing
+uint64_t os_now_ns();
+
+// Maps a whole file copy-on-write: the view is writable, but writes stay private to this process
+// and never reach the file. Returns null if the file cannot be opened or is empty.
+void* os_map_file(const char* path, size_t* size);
+void os_unmap_file(void* base, size_t size);
+
+// fopen, minus MSVC's deprecation of it. Returns null on failure.
+FILE* os_open_file(const char* path, const char* mode);
@@ -0,0 +1,80 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "core.h"
+
+#define INITIAL_CAPACITY (64 * 1024)
+
+// Room for a typical formatted line, so most output_printf calls format straight into the buffer
+#define PRINTF_RESERVE 256
+
+OutputBuffer output_new(Arena* arena) {
+    return (OutputBuffer) {
+        .arena = arena
+    };
+}
+
+// Grows in place while the buffer is the last thing on its arena, otherwise moves it
+static void reserve(OutputBuffer* out, size_t extra) {
+    size_t needed = out->length + extra;
+
+    if (needed <= out->capacity) {
+        return;
+    }
+
+    size_t new_capacity = out->capacity ? out->capacity * 2 : INITIAL_CAPACITY;
+
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    if (!out->data || !arena_try_grow(out->arena, out->data, out->capacity, new_capacity)) {
+        char* data = arena_push(out->arena, new_capacity);
+
+        if (out->length) {
+            memcpy(data, out->data, out->length);
+        }
+
+        out->data = data;
+    }
+
+    out->capacity = new_capacity;
+}
+
+void output_write(OutputBuffer* out, const char* str, size_t length) {
+    reserve(out, length);
+    memcpy(out->data + out->length, str, length);
+    out->length += length;
+}
+
+void output_printf(OutputBuffer* out, const char* format, ...) {
+    reserve(out, PRINTF_RESERVE);
+
+    va_list args;
+    va_start(args, format);
+
+    va_list retry_args;
+    va_copy(retry_args, args);
+
+    size_t available = out->capacity - out->length;
+    int length = vsnprintf(out->data + out->length, available, format, args);
+    assert("bad format string" && length >= 0);
+
+    if ((size_t)length >= available) {
+        reserve(out, (size_t)length + 1);
+        vsnprintf(out->data + out->length, out->capacity - out->length, format, retry_args);
+    }
+
+    out->length += length;
+
+    va_end(retry_args);
+    va_end(args);
+}
+
+void output_flush(OutputBuffer* out, FILE* file) {
+    if (out->length) {
+        fwrite(out->data, 1, out->length, file);
+    }
+
+    out->length = 0;
+}
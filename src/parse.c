@@ -18,30 +18,35 @@ typedef struct {
     Token last_rbrace;
 } Parser;
 
+#define MAP_NAME LocalMap
+#define MAP_PREFIX local_map
+#define MAP_KEY String
+#define MAP_VALUE HIR_Node*
+#define MAP_HASH(k) hash_bytes((k).str, (k).length)
+#define MAP_EQ(a, b) ((a).length == (b).length && memcmp((a).str, (b).str, (a).length) == 0)
+#include "hash_map.inc"
+
 typedef struct Scope Scope;
 struct Scope {
     Scope* parent;
-    HashMap locals;
+    LocalMap locals;
 };
 
 static Scope scope_new(Scope* parent) {
     return (Scope) {
-        .locals = hash_map_new(sizeof(String), sizeof(HIR_Node*), string_hash, string_cmp),
+        .locals = local_map_new(),
         .parent = parent
     };
 }
 
 static void scope_destroy(Scope* scope) {
-    hash_map_destroy(&scope->locals);
+    local_map_destroy(&scope->locals);
 }
 
 static HIR_Node* scope_find(Scope* scope, String name) {
-    if (hash_map_contains(&scope->locals, &name)) {
-        return *(HIR_Node**)hash_map_get(&scope->locals, &name);
-    }
-
-    if (scope->parent) {
-        return scope_find(scope->parent, name);
+    for (; scope; scope = scope->parent) {
+        HIR_Node** node = local_map_get(&scope->locals, name);
+        if (node) { return *node; }
     }
 
     return 0;
@@ -49,7 +54,7 @@ static HIR_Node* scope_find(Scope* scope, String name) {
 
 static void scope_insert(Scope* scope, String name, HIR_Node* node) {
     assert("scope already has symbol" && !scope_find(scope, name));
-    hash_map_insert(&scope->locals, &name, &node);
+    local_map_insert(&scope->locals, name, node);
 }
 
 static bool isident(char c) {
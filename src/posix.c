@@ -0,0 +1,123 @@
+#ifndef _WIN32
+
+// mmap flags, madvise and CLOCK_MONOTONIC are extensions that -std=c11 hides otherwise
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "os.h"
+
+#define DEFAULT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+size_t os_page_size() {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+size_t os_huge_page_size() {
+    size_t size = DEFAULT_HUGE_PAGE_SIZE;
+
+    #ifdef __linux__
+    FILE* file = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    if (file) {
+        unsigned long long value;
+        if (fscanf(file, "%llu", &value) == 1 && value) {
+            size = (size_t)value;
+        }
+        fclose(file);
+    }
+    #endif
+
+    return size;
+}
+
+void* os_reserve(size_t size, size_t alignment, bool huge_pages) {
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+
+    // Over-reserve so the range can be trimmed down to the requested alignment
+    size_t padded = size + alignment;
+
+    uint8_t* memory = mmap(0, padded, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        return 0;
+    }
+
+    uint8_t* aligned = (uint8_t*)(((size_t)memory + alignment - 1) & ~(alignment - 1));
+
+    size_t head = aligned - memory;
+    size_t tail = padded - head - size;
+
+    if (head) { munmap(memory, head); }
+    if (tail) { munmap(aligned + size, tail); }
+
+    // Transparent huge pages rather than MAP_HUGETLB: hugetlbfs pages have to be reserved up front
+    // from a pool the admin sizes, which does not mix with reserving far more than we commit.
+    #ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        madvise(aligned, size, MADV_HUGEPAGE);
+    }
+    #else
+    (void)huge_pages;
+    #endif
+
+    return aligned;
+}
+
+void os_release(void* base, size_t size) {
+    munmap(base, size);
+}
+
+bool os_commit(void* ptr, size_t size) {
+    return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+void os_decommit(void* ptr, size_t size) {
+    madvise(ptr, size, MADV_DONTNEED);
+    mprotect(ptr, size, PROT_NONE);
+}
+
+void* os_map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    void* base = 0;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        base = mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (base == MAP_FAILED) {
+            base = 0;
+        }
+        else {
+            *size = (size_t)st.st_size;
+        }
+    }
+
+    // The mapping keeps the file alive on its own
+    close(fd);
+
+    return base;
+}
+
+void os_unmap_file(void* base, size_t size) {
+    munmap(base, size);
+}
+
+FILE* os_open_file(const char* path, const char* mode) {
+    return fopen(path, mode);
+}
+
+uint64_t os_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+#endif
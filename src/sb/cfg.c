@@ -0,0 +1,452 @@
+#include "internal.h"
+#include "containers.h"
+
+// Control flow analyses. A block starts at every node flagged SB_NODE_FLAG_STARTS_BASIC_BLOCK and
+// takes in the control nodes that follow it through input 0 until the next block starts. Each
+// analysis fills in its part of the CFG_Blocks and builds on the ones before it:
+//
+//   ANALYSIS_CFG         blocks, edges and reverse postorder
+//   ANALYSIS_DOMINATORS  immediate dominators and dominator tree depth
+//   ANALYSIS_LOOPS       innermost loop and loop depth of every block
+//
+// Results live in the context's analysis arena and stay valid until something changes control
+// flow, which calls invalidate_analyses.
+
+static void add_edge(CFG_Block* from, CFG_Block* to) {
+    assert("block has more than two successors" && (size_t)from->num_succs < ARRAY_LENGTH(from->succs));
+    from->succs[from->num_succs++] = to;
+    to->preds[to->num_preds++] = from;
+}
+
+static Vec(CFG_Block*) get_block_postorder(Arena* arena, CFG_Block* entry, uint32_t num_blocks) {
+    typedef struct {
+        CFG_Block* block;
+        int next_succ;
+    } Frame;
+
+    Vec(CFG_Block*) result = vec_new(arena, CFG_Block*, num_blocks);
+    Vec(Frame) stack = vec_new(arena, Frame, 0);
+
+    Bitset* visited = bitset_alloc(arena, num_blocks);
+
+    bitset_set(visited, entry->index);
+    vec_push(stack, ((Frame) { .block = entry }));
+
+    while (vec_len(stack)) {
+        Frame* top = &stack[vec_len(stack)-1];
+        CFG_Block* block = top->block;
+
+        if (top->next_succ == block->num_succs) {
+            vec_pop(stack);
+            vec_push(result, block);
+            continue;
+        }
+
+        CFG_Block* succ = block->succs[top->next_succ++];
+
+        if (!bitset_get(visited, succ->index)) {
+            bitset_set(visited, succ->index);
+            vec_push(stack, ((Frame) { .block = succ }));
+        }
+    }
+
+    return result;
+}
+
+static void build_cfg(SB_Context* ctx, Arena* arena, SB_Proc* proc, CFG* cfg) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 1, &arena);
+
+    // Every control node reachable from the start
+
+    Vec(SB_Node*) nodes = vec_new(scratch->arena, SB_Node*, 0);
+    Vec(SB_Node*) stack = vec_new(scratch->arena, SB_Node*, 0);
+    Bitset* visited = bitset_alloc(scratch->arena, ctx->next_id);
+
+    vec_push(stack, proc->start);
+
+    while (vec_len(stack)) {
+        SB_Node* node = vec_pop(stack);
+
+        if (bitset_get(visited, node->id)) { continue; }
+        bitset_set(visited, node->id);
+
+        vec_push(nodes, node);
+
+        for (uint32_t i = 0; i < node->num_users; ++i) {
+            SB_Node* user = node->users[i].node;
+            if (!(user->flags & SB_NODE_FLAG_TRANSFERS_CONTROL)) { continue; }
+            vec_push(stack, user);
+        }
+    }
+
+    // Blocks, numbered in discovery order for now
+
+    CFG_Block** node_blocks = arena_array(arena, CFG_Block*, ctx->next_id);
+    Vec(CFG_Block*) blocks = vec_new(scratch->arena, CFG_Block*, 0);
+
+    for (size_t i = 0; i < vec_len(nodes); ++i) {
+        SB_Node* node = nodes[i];
+        if (!(node->flags & SB_NODE_FLAG_STARTS_BASIC_BLOCK)) { continue; }
+
+        CFG_Block* block = arena_type(arena, CFG_Block);
+        block->head = node;
+        block->index = (uint32_t)vec_len(blocks);
+
+        node_blocks[node->id] = block;
+        vec_push(blocks, block);
+    }
+
+    for (size_t i = 0; i < vec_len(nodes); ++i) {
+        SB_Node* head = nodes[i];
+
+        while (!(head->flags & SB_NODE_FLAG_STARTS_BASIC_BLOCK)) {
+            head = head->ins[0];
+        }
+
+        node_blocks[nodes[i]->id] = node_blocks[head->id];
+    }
+
+    // An edge wherever a block start uses a control node of another block. Inputs of regions
+    // that are not reachable from the start get no edge.
+
+    for (size_t i = 0; i < vec_len(blocks); ++i) {
+        SB_Node* head = blocks[i]->head;
+
+        for (int j = 0; j < head->num_ins; ++j) {
+            if (head->ins[j] && bitset_get(visited, head->ins[j]->id)) {
+                blocks[i]->num_preds++;
+            }
+        }
+
+        blocks[i]->preds = arena_array(arena, CFG_Block*, blocks[i]->num_preds);
+        blocks[i]->num_preds = 0;
+    }
+
+    for (size_t i = 0; i < vec_len(nodes); ++i) {
+        SB_Node* node = nodes[i];
+
+        for (uint32_t j = 0; j < node->num_users; ++j) {
+            SB_Node* user = node->users[j].node;
+
+            if ((user->flags & SB_NODE_FLAG_STARTS_BASIC_BLOCK) && bitset_get(visited, user->id)) {
+                add_edge(node_blocks[node->id], node_blocks[user->id]);
+            }
+        }
+    }
+
+    // Renumber in reverse postorder
+
+    CFG_Block* entry = node_blocks[proc->start->id];
+    Vec(CFG_Block*) postorder = get_block_postorder(scratch->arena, entry, (uint32_t)vec_len(blocks));
+
+    uint32_t num_blocks = (uint32_t)vec_len(postorder);
+    CFG_Block** rpo = arena_array(arena, CFG_Block*, num_blocks);
+
+    for (uint32_t i = 0; i < num_blocks; ++i) {
+        rpo[i] = postorder[num_blocks - 1 - i];
+        rpo[i]->index = i;
+    }
+
+    scratch_release(scratch);
+
+    *cfg = (CFG) {
+        .num_blocks = num_blocks,
+        .blocks = rpo,
+        .num_ids = ctx->next_id,
+        .node_blocks = node_blocks,
+    };
+}
+
+static CFG_Block* intersect(CFG_Block* a, CFG_Block* b) {
+    while (a != b) {
+        while (a->index > b->index) { a = a->idom; }
+        while (b->index > a->index) { b = b->idom; }
+    }
+
+    return a;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+static void compute_dominators(CFG* cfg) {
+    CFG_Block* entry = cfg->blocks[0];
+    entry->idom = entry;
+
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (uint32_t i = 1; i < cfg->num_blocks; ++i) {
+            CFG_Block* block = cfg->blocks[i];
+            CFG_Block* idom = 0;
+
+            for (int j = 0; j < block->num_preds; ++j) {
+                CFG_Block* pred = block->preds[j];
+                if (!pred->idom) { continue; }
+
+                idom = idom ? intersect(pred, idom) : pred;
+            }
+
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    entry->idom = 0;
+
+    // Reverse postorder visits every immediate dominator before the blocks it dominates
+    for (uint32_t i = 1; i < cfg->num_blocks; ++i) {
+        CFG_Block* block = cfg->blocks[i];
+        block->dom_depth = block->idom->dom_depth + 1;
+    }
+}
+
+static CFG_Block* outermost_loop(CFG_Block* header) {
+    while (header->loop_parent) {
+        header = header->loop_parent;
+    }
+
+    return header;
+}
+
+// Headers are visited from the last in reverse postorder to the first, so inner loops are found
+// before the loops around them. Each loop's body is walked backwards from its back edges, and a
+// block already claimed by an inner loop makes that loop a child of this one instead.
+static void compute_loops(SB_Context* ctx, CFG* cfg) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+    Vec(CFG_Block*) stack = vec_new(scratch->arena, CFG_Block*, 0);
+
+    for (uint32_t i = cfg->num_blocks; i-- > 0;) {
+        CFG_Block* header = cfg->blocks[i];
+
+        for (int j = 0; j < header->num_preds; ++j) {
+            if (cfg_dominates(header, header->preds[j])) {
+                vec_push(stack, header->preds[j]);
+            }
+        }
+
+        if (!vec_len(stack)) { continue; }
+
+        header->loop_header = header;
+
+        while (vec_len(stack)) {
+            CFG_Block* block = vec_pop(stack);
+
+            if (!block->loop_header) {
+                block->loop_header = header;
+
+                for (int j = 0; j < block->num_preds; ++j) {
+                    vec_push(stack, block->preds[j]);
+                }
+
+                continue;
+            }
+
+            CFG_Block* inner = outermost_loop(block->loop_header);
+            if (inner == header) { continue; }
+
+            inner->loop_parent = header;
+
+            for (int j = 0; j < inner->num_preds; ++j) {
+                vec_push(stack, inner->preds[j]);
+            }
+        }
+    }
+
+    // Outer headers come first in reverse postorder, so a loop's depth is known before its body's
+    for (uint32_t i = 0; i < cfg->num_blocks; ++i) {
+        CFG_Block* block = cfg->blocks[i];
+
+        if (block->loop_header == block) {
+            block->loop_depth = block->loop_parent ? block->loop_parent->loop_depth + 1 : 1;
+        }
+        else if (block->loop_header) {
+            block->loop_depth = block->loop_header->loop_depth;
+        }
+    }
+
+    scratch_release(scratch);
+}
+
+bool cfg_dominates(CFG_Block* a, CFG_Block* b) {
+    while (b && b->dom_depth > a->dom_depth) {
+        b = b->idom;
+    }
+
+    return a == b;
+}
+
+CFG* get_analysis(SB_Context* ctx, SB_Proc* proc, Analysis analysis) {
+    if (ctx->analysis_proc != proc) {
+        invalidate_analyses(ctx);
+        ctx->analysis_proc = proc;
+    }
+
+    for (int i = 0; i <= (int)analysis; ++i) {
+        if (ctx->valid_analyses & (1 << i)) { continue; }
+
+        switch (i) {
+            case ANALYSIS_CFG:
+                build_cfg(ctx, ctx->analysis_arena, proc, &ctx->cfg);
+                break;
+            case ANALYSIS_DOMINATORS:
+                compute_dominators(&ctx->cfg);
+                break;
+            case ANALYSIS_LOOPS:
+                compute_loops(ctx, &ctx->cfg);
+                break;
+        }
+
+        ctx->valid_analyses |= 1 << i;
+    }
+
+    return &ctx->cfg;
+}
+
+void invalidate_analyses(SB_Context* ctx) {
+    if (!ctx->valid_analyses && !ctx->analysis_proc) { return; }
+
+    arena_reset(ctx->analysis_arena);
+
+    ctx->valid_analyses = 0;
+    ctx->analysis_proc = 0;
+    ctx->cfg = (CFG) {0};
+}
+
+Bitset* get_control_reaching_end(SB_Context* ctx, Arena* arena, SB_Proc* proc, Bitset* blocked) {
+    Bitset* result = bitset_alloc(arena, ctx->next_id);
+    Vec(SB_Node*) stack = vec_new(arena, SB_Node*, 0);
+
+    vec_push(stack, proc->end->ins[END_CTRL]);
+
+    while (vec_len(stack)) {
+        SB_Node* node = vec_pop(stack);
+
+        if (bitset_get(blocked, node->id) || bitset_get(result, node->id)) { continue; }
+        bitset_set(result, node->id);
+
+        if (node->op == SB_OP_REGION) {
+            for (int i = 0; i < node->num_ins; ++i) {
+                vec_push(stack, node->ins[i]);
+            }
+        }
+        else if (node->op != SB_OP_START) {
+            vec_push(stack, node->ins[0]); // The control or branch it carries on from
+        }
+    }
+
+    return result;
+}
+
+// Control the start reaches but that does not get to the end is stuck, and falls into components
+// of control that reach each other (Kosaraju's algorithm: a postorder of the stuck control, then
+// walks back over inputs in reverse postorder). A component that no unblocked edge leaves is a loop
+// that never exits as things stand. Stuck control elsewhere only ever runs into one of these, so
+// their exits are the only ones that have to come back.
+Vec(SB_Node*) get_stuck_loop_branches(SB_Context* ctx, Arena* arena, SB_Proc* proc, Bitset* blocked) {
+    typedef struct {
+        SB_Node* node;
+        uint32_t next_user;
+    } Frame;
+
+    Vec(SB_Node*) result = vec_new(arena, SB_Node*, 0);
+
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 1, &arena);
+    Bitset* reaching_end = get_control_reaching_end(ctx, scratch->arena, proc, blocked);
+
+    Bitset* visited = bitset_alloc(scratch->arena, ctx->next_id);
+    Vec(SB_Node*) postorder = vec_new(scratch->arena, SB_Node*, 0);
+    Vec(Frame) frames = vec_new(scratch->arena, Frame, 0);
+
+    bitset_set(visited, proc->start->id);
+    vec_push(frames, ((Frame) { .node = proc->start }));
+
+    while (vec_len(frames)) {
+        Frame* top = &frames[vec_len(frames)-1];
+        SB_Node* node = top->node;
+
+        if (top->next_user == node->num_users) {
+            vec_pop(frames);
+
+            if (!bitset_get(reaching_end, node->id)) {
+                vec_push(postorder, node);
+            }
+
+            continue;
+        }
+
+        SB_Node* user = node->users[top->next_user++].node;
+
+        if ((user->flags & SB_NODE_FLAG_TRANSFERS_CONTROL) && !bitset_get(blocked, user->id) && !bitset_get(visited, user->id)) {
+            bitset_set(visited, user->id);
+            vec_push(frames, ((Frame) { .node = user }));
+        }
+    }
+
+    // Component numbers start at 1, 0 is for control that is not stuck
+    uint32_t* components = arena_array(scratch->arena, uint32_t, ctx->next_id);
+    uint32_t num_components = 0;
+
+    Vec(SB_Node*) stack = vec_new(scratch->arena, SB_Node*, 0);
+
+    for (size_t i = vec_len(postorder); i-- > 0;) {
+        if (components[postorder[i]->id]) { continue; }
+
+        uint32_t component = ++num_components;
+
+        components[postorder[i]->id] = component;
+        vec_push(stack, postorder[i]);
+
+        while (vec_len(stack)) {
+            SB_Node* node = vec_pop(stack);
+
+            int num_preds = node->op == SB_OP_REGION ? node->num_ins : node->op == SB_OP_START ? 0 : 1;
+
+            for (int j = 0; j < num_preds; ++j) {
+                SB_Node* pred = node->ins[j];
+
+                // Stuck, as what reaches a stuck node and is not stuck itself was not pushed
+                bool stuck = bitset_get(visited, pred->id) && !bitset_get(blocked, pred->id) && !bitset_get(reaching_end, pred->id);
+
+                if (stuck && !components[pred->id]) {
+                    components[pred->id] = component;
+                    vec_push(stack, pred);
+                }
+            }
+        }
+    }
+
+    Bitset* left = bitset_alloc(scratch->arena, num_components + 1);
+
+    for (size_t i = 0; i < vec_len(postorder); ++i) {
+        SB_Node* node = postorder[i];
+
+        for (uint32_t j = 0; j < node->num_users; ++j) {
+            SB_Node* user = node->users[j].node;
+
+            if (!(user->flags & SB_NODE_FLAG_TRANSFERS_CONTROL) || bitset_get(blocked, user->id)) { continue; }
+
+            if (components[user->id] != components[node->id]) {
+                bitset_set(left, components[node->id]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < vec_len(postorder); ++i) {
+        SB_Node* node = postorder[i];
+        if (node->op != SB_OP_BRANCH || bitset_get(left, components[node->id])) { continue; }
+
+        for (uint32_t j = 0; j < node->num_users; ++j) {
+            if (bitset_get(blocked, node->users[j].node->id)) {
+                vec_push(result, node);
+                break;
+            }
+        }
+    }
+
+    scratch_release(scratch);
+
+    return result;
+}
@@ -0,0 +1,128 @@
+#include "internal.h"
+#include "containers.h"
+
+// Postorder over inputs, so every node lands after the nodes it uses (cycles through phis and
+// regions aside). Passes that walk the graph from the definitions up then touch memory in order.
+// The start goes in even when the end no longer reaches it, so the copy always has one.
+static Vec(SB_Node*) get_input_postorder(SB_Context* ctx, Arena* arena, SB_Proc* proc) {
+    typedef struct {
+        SB_Node* node;
+        int next_input;
+    } Frame;
+
+    Vec(SB_Node*) result = vec_new(arena, SB_Node*, 0);
+    Vec(Frame) stack = vec_new(arena, Frame, 0);
+
+    Bitset* visited = bitset_alloc(arena, ctx->next_id);
+
+    bitset_set(visited, proc->start->id);
+    vec_push(result, proc->start);
+
+    bitset_set(visited, proc->end->id);
+    vec_push(stack, ((Frame) { .node = proc->end }));
+
+    while (vec_len(stack)) {
+        Frame* top = &stack[vec_len(stack)-1];
+        SB_Node* node = top->node;
+
+        if (top->next_input == node->num_ins) {
+            vec_pop(stack);
+            vec_push(result, node);
+            continue;
+        }
+
+        SB_Node* input = node->ins[top->next_input++];
+
+        if (input && !bitset_get(visited, input->id)) {
+            bitset_set(visited, input->id);
+            vec_push(stack, ((Frame) { .node = input }));
+        }
+    }
+
+    return result;
+}
+
+// Inputs and users are filled in once every node has a copy. Regions and phis get their
+// inputs inline here as well.
+static SB_Node* copy_node(Arena* arena, SB_Node* old_node, uint32_t id) {
+    SB_Node* node = alloc_node(arena, old_node->num_ins, old_node->data_size);
+    node->op = old_node->op;
+    node->flags = old_node->flags;
+    node->id = id;
+
+    memcpy(node + 1, old_node + 1, old_node->data_size);
+
+    return node;
+}
+
+SB_Proc* sb_compact(SB_Context* ctx, SB_Proc* proc) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+
+    Vec(SB_Node*) order = get_input_postorder(ctx, scratch->arena, proc);
+
+    // Old node ID -> copy, null for nodes that are not reachable from the end
+    SB_Node** forward = arena_array(scratch->arena, SB_Node*, ctx->next_id);
+
+    Arena* arena = ctx->spare_arena;
+
+    // Nodes first, so they sit in the order they are used. The copies are numbered in the same
+    // order, which keeps IDs dense.
+
+    for (size_t i = 0; i < vec_len(order); ++i) {
+        forward[order[i]->id] = copy_node(arena, order[i], (uint32_t)i);
+    }
+
+    // Then rewire. Users that are not reachable from the end are dead and get dropped
+
+    for (size_t i = 0; i < vec_len(order); ++i) {
+        SB_Node* old_node = order[i];
+        SB_Node* node = forward[old_node->id];
+
+        for (int j = 0; j < node->num_ins; ++j) {
+            if (old_node->ins[j]) {
+                node->ins[j] = forward[old_node->ins[j]->id];
+            }
+        }
+
+        reserve_users(arena, node, old_node->num_users);
+
+        for (uint32_t j = 0; j < old_node->num_users; ++j) {
+            SB_User u = old_node->users[j];
+
+            u.node = forward[u.node->id];
+            if (!u.node) { continue; }
+
+            push_user(arena, node, u);
+        }
+    }
+
+    // The value table pointed into the old arena
+
+    value_table_destroy(&ctx->values);
+    ctx->values = value_table_new();
+
+    for (size_t i = 0; i < vec_len(order); ++i) {
+        value_number(ctx, forward[order[i]->id]);
+    }
+
+    SB_Proc* result = arena_type(arena, SB_Proc);
+    result->start = forward[proc->start->id];
+    result->end = forward[proc->end->id];
+
+    ctx->next_id = (uint32_t)vec_len(order);
+
+    scratch_release(scratch);
+
+    // Every node moved
+    invalidate_analyses(ctx);
+
+    // The old nodes are dropped but their pages stay committed for the next compaction
+    arena_reset(ctx->arena);
+    ctx->spare_arena = ctx->arena;
+    ctx->arena = arena;
+
+    // Loaded nodes have all been copied too
+    sb_release_mappings(ctx);
+
+    return result;
+}
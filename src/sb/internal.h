@@ -1,12 +1,119 @@
 #include "sb.h"
 #include "core.h"
 #include "containers.h"
+#include "int128.h"
 
-#define VIEW_DATA(n, type) (*(type*)((n)->data))
+#define VIEW_DATA(n, type) (*(type*)((n) + 1))
+
+#define X(name, mnemonic, pure) pure,
+static const bool sb_op_is_pure[] = {
+    false,
+    #include "ops.inc"
+};
+#undef X
+
+// Value numbering: pure nodes hash and compare by op, inputs and payload
+
+static inline uint64_t value_hash(SB_Node* node) {
+    uint64_t hash = hash_u64(node->op);
+
+    for (int i = 0; i < node->num_ins; ++i) {
+        hash = hash_u64(hash ^ (uint64_t)node->ins[i]);
+    }
+
+    if (node->data_size) {
+        hash ^= hash_bytes(node + 1, node->data_size);
+    }
+
+    return hash;
+}
+
+static inline bool value_equal(SB_Node* a, SB_Node* b) {
+    if (a->op != b->op || a->num_ins != b->num_ins || a->data_size != b->data_size) {
+        return false;
+    }
+
+    for (int i = 0; i < a->num_ins; ++i) {
+        if (a->ins[i] != b->ins[i]) { return false; }
+    }
+
+    return memcmp(a + 1, b + 1, a->data_size) == 0;
+}
+
+#define MAP_NAME ValueTable
+#define MAP_PREFIX value_table
+#define MAP_KEY SB_Node*
+#define MAP_HASH(k) value_hash(k)
+#define MAP_EQ(a, b) value_equal(a, b)
+#include "hash_map.inc"
+
+// Control flow analyses, see cfg.c. A block's fields are filled in by the analysis noted next to them
+
+typedef enum {
+    ANALYSIS_CFG,
+    ANALYSIS_DOMINATORS,
+    ANALYSIS_LOOPS,
+    NUM_ANALYSES
+} Analysis;
+
+typedef struct CFG_Block CFG_Block;
+
+struct CFG_Block {
+    SB_Node* head; // The start, a region or a branch projection
+    uint32_t index; // Position in reverse postorder
+
+    int num_preds;
+    CFG_Block** preds;
+
+    int num_succs;
+    CFG_Block* succs[2];
+
+    // ANALYSIS_DOMINATORS
+    CFG_Block* idom; // Null for the entry block
+    uint32_t dom_depth;
+
+    // ANALYSIS_LOOPS
+    CFG_Block* loop_header; // Header of the innermost loop around the block, which a header is itself
+    CFG_Block* loop_parent; // For headers, the header of the enclosing loop
+    uint32_t loop_depth;
+};
+
+typedef struct {
+    uint32_t num_blocks;
+    CFG_Block** blocks; // Reverse postorder, the entry block first
+
+    uint32_t num_ids;
+    CFG_Block** node_blocks; // Indexed by node ID, set for control nodes only
+} CFG;
+
+// A file loaded by sb_read_proc. Its nodes live in the mapping itself, so it stays mapped until
+// the nodes are discarded or copied out by sb_compact
+typedef struct SB_Mapping SB_Mapping;
+
+struct SB_Mapping {
+    SB_Mapping* next;
+    void* base;
+    size_t size;
+};
 
 struct SB_Context {
     Arena* arena;
+    Arena* spare_arena; // Empty, sb_compact copies into it and swaps it with 'arena'
     ScratchLibrary scratch_lib;
+
+    uint32_t next_id; // Every node built so far has an ID below this
+
+    // One node per distinct pure value. A node's key is its inputs, so anything that rewires a
+    // node's inputs has to forget it first and re-number it after.
+    ValueTable values;
+
+    SB_Mapping* mappings;
+
+    // Analyses of 'analysis_proc' built so far, one bit per Analysis
+    Arena* analysis_arena;
+    SB_Proc* analysis_proc;
+    uint32_t valid_analyses;
+    CFG cfg;
 };
 
 enum {
@@ -48,45 +155,171 @@ enum {
     NUM_STORE_INS
 };
 
-typedef struct {
-    HashSet set;
-} NodeSet;
+// Input pointers followed by the position of each input's edge in that input's use list
+static inline size_t input_array_size(int num_ins) {
+    return num_ins * (sizeof(SB_Node*) + sizeof(uint32_t));
+}
+
+static inline uint32_t* use_positions(SB_Node* node) {
+    return (uint32_t*)(node->ins + node->num_ins);
+}
+
+// Zeroed node with room for its payload and 'num_ins' inline inputs, see SB_Node
+static inline SB_Node* alloc_node(Arena* arena, int num_ins, int data_size) {
+    size_t payload_size = ((size_t)data_size + 7) & ~(size_t)7;
+
+    SB_Node* node = arena_zero(arena, sizeof(SB_Node) + payload_size + input_array_size(num_ins));
+    node->data_size = (uint16_t)data_size;
+    node->num_ins = num_ins;
+    node->ins = (SB_Node**)((uint8_t*)(node + 1) + payload_size);
+
+    return node;
+}
+
+// Most nodes have a single user, so use lists start at one and double, growing in place while
+// they are the last thing on the arena
+static inline void reserve_users(Arena* arena, SB_Node* node, uint32_t num_users) {
+    if (num_users <= node->user_capacity) { return; }
+
+    uint32_t new_capacity = node->user_capacity * 2 > num_users ? node->user_capacity * 2 : num_users;
+
+    size_t old_size = node->user_capacity * sizeof(SB_User);
+    size_t new_size = new_capacity * sizeof(SB_User);
+
+    if (!node->users || !arena_try_grow(arena, node->users, old_size, new_size)) {
+        SB_User* users = arena_push(arena, new_size);
+
+        if (node->num_users) {
+            memcpy(users, node->users, node->num_users * sizeof(SB_User));
+        }
 
-static NodeSet node_set_new() {
-    return (NodeSet) {
-        .set = hash_set_new(sizeof(SB_Node*), pointer_hash, pointer_cmp)
-    };
+        node->users = users;
+    }
+
+    node->user_capacity = new_capacity;
+}
+
+static inline void push_user(Arena* arena, SB_Node* node, SB_User user) {
+    reserve_users(arena, node, node->num_users + 1);
+
+    use_positions(user.node)[user.index] = node->num_users;
+    node->users[node->num_users++] = user;
+}
+
+// Records 'node' as a user of its input 'index'
+static inline void add_user(Arena* arena, SB_Node* node, int index) {
+    push_user(arena, node->ins[index], (SB_User) { .node = node, .index = index });
+}
+
+// Unlinks 'node' from the use list of its input 'index' by moving the last use into its place
+static inline void remove_user(SB_Node* node, int index) {
+    SB_Node* input = node->ins[index];
+    uint32_t position = use_positions(node)[index];
+
+    assert("not in user list" && input->users[position].node == node && input->users[position].index == index);
+
+    SB_User last = input->users[--input->num_users];
+
+    if (position < input->num_users) {
+        input->users[position] = last;
+        use_positions(last.node)[last.index] = position;
+    }
+}
+
+// Removes input 'index' of a region or phi and moves the inputs after it down one. The use
+// positions sit right after the inputs, so they move down with them.
+static inline void remove_input(SB_Node* node, int index) {
+    uint32_t* old_positions = use_positions(node);
+
+    remove_user(node, index);
+
+    for (int i = index + 1; i < node->num_ins; ++i) {
+        node->ins[i-1] = node->ins[i];
+        node->ins[i-1]->users[old_positions[i]].index = i-1;
+    }
+
+    node->num_ins--;
+
+    // The new positions start below the old ones, so copying in order never overwrites one unread
+    uint32_t* positions = use_positions(node);
+
+    for (int i = 0; i < node->num_ins; ++i) {
+        positions[i] = old_positions[i < index ? i : i + 1];
+    }
+}
+
+// The existing node computing the same value as 'node', which may be a stack-built probe
+static inline SB_Node* find_value(SB_Context* ctx, SB_Node* node) {
+    SB_Node** existing = value_table_find(&ctx->values, node);
+    return existing ? *existing : 0;
+}
+
+// Returns the node that now stands for node's value: an existing equivalent, or 'node' itself
+// once it has been recorded
+static inline SB_Node* value_number(SB_Context* ctx, SB_Node* node) {
+    if (!sb_op_is_pure[node->op]) {
+        return node;
+    }
+
+    SB_Node* existing = find_value(ctx, node);
+
+    if (existing) {
+        return existing;
+    }
+
+    value_table_insert(&ctx->values, node);
+    return node;
 }
 
-static void node_set_destroy(NodeSet* set) {
-    hash_set_destroy(&set->set);
+// Drops 'node' from the table, leaving an equivalent node that holds the entry alone
+static inline void forget_value(SB_Context* ctx, SB_Node* node) {
+    if (sb_op_is_pure[node->op] && find_value(ctx, node) == node) {
+        value_table_remove(&ctx->values, node);
+    }
 }
 
-static void node_set_add(NodeSet* set, SB_Node* node) {
-    hash_set_insert(&set->set, &node);
+// Points every use of 'from' at 'to' instead, leaving 'from' without users. The users' value
+// numbers change with their inputs, so they are forgotten here and have to be numbered again.
+static inline void move_users(SB_Context* ctx, SB_Node* from, SB_Node* to) {
+    reserve_users(ctx->arena, to, to->num_users + from->num_users);
+
+    for (uint32_t i = 0; i < from->num_users; ++i) {
+        SB_User u = from->users[i];
+
+        forget_value(ctx, u.node);
+        u.node->ins[u.index] = to;
+
+        push_user(ctx->arena, to, u);
+    }
+
+    from->num_users = 0;
 }
 
-static bool node_set_contains(NodeSet* set, SB_Node* node) {
-    return hash_set_contains(&set->set, &node);
+// Constant folding, shared by rules.inc and sccp.c
+
+static inline bool sdiv_traps(uint64_t left, uint64_t right) {
+    return right == 0 || (left == (uint64_t)INT64_MIN && right == (uint64_t)-1);
 }
 
-static void node_set_remove(NodeSet* set, SB_Node* node) {
-    hash_set_remove(&set->set, &node);
+static inline uint64_t signed_mulhi(uint64_t left, uint64_t right) {
+    return int128_mul(int128_from_int64((int64_t)left), int128_from_int64((int64_t)right)).high;
 }
 
 typedef void(*VisitNodeFn)(SB_Node*, void*);
 
-static void walk_graph(SB_Node* end, NodeSet* visited_out, VisitNodeFn visit_fn, void* visit_ctx) {
-    Vec(SB_Node*) stack = 0;
-    vec_push(stack, end);
+// Returns the set of visited node IDs. It and the DFS stack are pushed onto 'arena', so pass a
+// scratch arena the caller releases
+static inline Bitset* walk_graph(SB_Context* ctx, Arena* arena, SB_Node* end, VisitNodeFn visit_fn, void* visit_ctx) {
+    Bitset* visited = bitset_alloc(arena, ctx->next_id);
 
-    NodeSet visited = node_set_new();
+    Vec(SB_Node*) stack = vec_new(arena, SB_Node*, 0);
+    vec_push(stack, end);
 
     while (vec_len(stack)) {
         SB_Node* node = vec_pop(stack);
 
-        if (node_set_contains(&visited, node)) { continue; }
-        node_set_add(&visited, node);
+        if (bitset_get(visited, node->id)) { continue; }
+        bitset_set(visited, node->id);
 
         if (visit_fn) {
             visit_fn(node, visit_ctx);
@@ -99,14 +332,32 @@ static void walk_graph(SB_Node* end, NodeSet* visited_out, VisitNodeFn visit_fn,
         }
     }
 
-    if (visited_out) {
-        *visited_out = visited;
-    }
-    else {
-        node_set_destroy(&visited);
-    }
-
-    vec_destroy(stack);
+    return visited;
 }
 
-SB_Schedule* schedule(Arena* arena, SB_Proc* proc);
\ No newline at end of file
+// Returns proc's CFG with 'analysis' and the analyses it builds on filled in, reusing what is
+// still valid from earlier requests
+CFG* get_analysis(SB_Context* ctx, SB_Proc* proc, Analysis analysis);
+
+// Anything that adds or removes control nodes has to call this
+void invalidate_analyses(SB_Context* ctx);
+
+bool cfg_dominates(CFG_Block* a, CFG_Block* b);
+
+// Control nodes that get to the end without passing through a node in 'blocked'. Passes that
+// rule out branch arms block them, to see what control flow would be left.
+Bitset* get_control_reaching_end(SB_Context* ctx, Arena* arena, SB_Proc* proc, Bitset* blocked);
+
+// The branches with an arm in 'blocked' that are the only way out of a loop the start reaches but
+// that no longer gets to the end. Only the innermost such loops are found, so a pass unblocks
+// their arms and asks again until none are left. A loop that never exits stays alive through
+// its exit branch alone, so it would be dropped as dead code without this.
+Vec(SB_Node*) get_stuck_loop_branches(SB_Context* ctx, Arena* arena, SB_Proc* proc, Bitset* blocked);
+
+// Unlinks every node that 'end' no longer reaches from the live nodes' use lists and rebuilds the
+// value table from the live nodes
+void remove_dead_nodes(SB_Context* ctx, SB_Node* start, SB_Node* end);
+
+void sb_release_mappings(SB_Context* ctx);
+
+SB_Schedule* schedule(SB_Context* ctx, Arena* arena, SB_Proc* proc);
\ No newline at end of file
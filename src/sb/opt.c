@@ -1,46 +1,66 @@
 #include "internal.h"
 #include "containers.h"
 
-typedef struct {
-    HashMap map;
-} IndexMap;
-
-static IndexMap index_map_new() { return (IndexMap) { .map = hash_map_new(sizeof(SB_Node*), sizeof(size_t), pointer_hash, pointer_cmp) }; }
-static void index_map_destroy(IndexMap* map) { hash_map_destroy(&map->map); } 
-static void index_map_insert(IndexMap* map, SB_Node* node, size_t index) { hash_map_insert(&map->map, &node, &index); }
-static size_t index_map_get(IndexMap* map, SB_Node* node) { return *(size_t*)hash_map_get(&map->map, &node); }
-static bool index_map_contains(IndexMap* map, SB_Node* node) { return hash_map_contains(&map->map, &node); }
-static void index_map_remove(IndexMap* map, SB_Node* node) { hash_map_remove(&map->map, &node); }
+#define NOT_ON_WORKLIST 0xffffffff
 
+// A stack of nodes plus each node's position in it, indexed by node ID, so membership tests and
+// removal from the middle are a single array access. Passes can build nodes while it is in use,
+// so the position array grows on demand.
 typedef struct {
+    Arena* arena;
     Vec(SB_Node*) stack;
-    IndexMap index_map;
+
+    uint32_t num_ids;
+    uint32_t* positions;
+
+    Vec(SB_Node*) constant_branches; // Waiting for fold_constant_branches
 } Worklist;
 
-static Worklist worklist_new() {
-    return (Worklist) {
-        .index_map = index_map_new()
+static void worklist_reserve(Worklist* wl, uint32_t num_ids) {
+    if (num_ids <= wl->num_ids) { return; }
+
+    uint32_t new_num_ids = wl->num_ids * 2 > num_ids ? wl->num_ids * 2 : num_ids;
+    uint32_t* positions = arena_push(wl->arena, new_num_ids * sizeof(uint32_t));
+
+    if (wl->num_ids) {
+        memcpy(positions, wl->positions, wl->num_ids * sizeof(uint32_t));
+    }
+
+    memset(positions + wl->num_ids, 0xff, (new_num_ids - wl->num_ids) * sizeof(uint32_t));
+
+    wl->num_ids = new_num_ids;
+    wl->positions = positions;
+}
+
+static Worklist worklist_new(Arena* arena, uint32_t num_ids) {
+    Worklist wl = {
+        .arena = arena
     };
+
+    worklist_reserve(&wl, num_ids);
+    wl.stack = vec_new(arena, SB_Node*, 0);
+    wl.constant_branches = vec_new(arena, SB_Node*, 0);
+
+    return wl;
 }
 
-static void worklist_destroy(Worklist* wl) {
-    index_map_destroy(&wl->index_map);
-    vec_destroy(wl->stack);
+static bool worklist_contains(Worklist* wl, SB_Node* node) {
+    return node->id < wl->num_ids && wl->positions[node->id] != NOT_ON_WORKLIST;
 }
 
 static void worklist_push(Worklist* wl, SB_Node* node) {
-    if (index_map_contains(&wl->index_map, node)) { return; }
+    if (worklist_contains(wl, node)) { return; }
 
-    size_t i = vec_len(wl->stack);
-    vec_push(wl->stack, node);
+    worklist_reserve(wl, node->id + 1);
+    wl->positions[node->id] = (uint32_t)vec_len(wl->stack);
 
-    index_map_insert(&wl->index_map, node, i);
+    vec_push(wl->stack, node);
 }
 
 static SB_Node* worklist_pop(Worklist* wl) {
     SB_Node* node = vec_pop(wl->stack);
-    assert(index_map_get(&wl->index_map, node) == vec_len(wl->stack));
-    index_map_remove(&wl->index_map, node);
+    assert(wl->positions[node->id] == vec_len(wl->stack));
+    wl->positions[node->id] = NOT_ON_WORKLIST;
     return node;
 }
 
@@ -49,12 +69,13 @@ static bool worklist_empty(Worklist* wl) {
 }
 
 static void worklist_remove(Worklist* wl, SB_Node* node) {
-    if (!index_map_contains(&wl->index_map, node)) { return; }
+    if (!worklist_contains(wl, node)) { return; }
 
-    size_t index = index_map_get(&wl->index_map, node);
-    SB_Node* last = wl->stack[index] = vec_pop(wl->stack);
-    index_map_insert(&wl->index_map, last, index);
-    index_map_remove(&wl->index_map, node);
+    uint32_t position = wl->positions[node->id];
+    SB_Node* last = wl->stack[position] = vec_pop(wl->stack);
+
+    wl->positions[last->id] = position;
+    wl->positions[node->id] = NOT_ON_WORKLIST;
 }
 
 typedef struct {
@@ -66,52 +87,39 @@ static void worklist_init_fn(SB_Node* node, void* _ctx) {
     worklist_push(ctx->wl, node);
 }
 
-static void init_worklist(Worklist* wl, SB_Proc* proc) {
+static void init_worklist(SB_Context* ctx, Arena* arena, Worklist* wl, SB_Proc* proc) {
     WorklistInitContext init_ctx = {
         .wl = wl
     };
 
-    walk_graph(proc->end, 0, worklist_init_fn, &init_ctx);
+    walk_graph(ctx, arena, proc->end, worklist_init_fn, &init_ctx);
 }
 
-static void remove_user(SB_Node* node, SB_Node* user, int index) {
-    for (SB_User** u = &node->users; *u; u = &(*u)->next) {
-        if ((*u)->node == user && (*u)->index == index) {
-            *u = (*u)->next;
-            return;
-        }
-    }
-
-    assert("not in user list" && false);
-}
-
-static void delete_node(Worklist* wl, SB_Node* node) {
-    assert("trying to remove a node that has users" && !node->users);
+static void delete_node(SB_Context* ctx, Worklist* wl, SB_Node* node) {
+    assert("trying to remove a node that has users" && !node->num_users);
 
     worklist_remove(wl, node);
+    forget_value(ctx, node);
+
+    if (node->flags & (SB_NODE_FLAG_STARTS_BASIC_BLOCK | SB_NODE_FLAG_TRANSFERS_CONTROL)) {
+        invalidate_analyses(ctx);
+    }
 
     for (int i = 0; i < node->num_ins; ++i) {
-        node->ins[i];
-        remove_user(node->ins[i], node, i);
+        remove_user(node, i);
 
-        if (!node->ins[i]->users) {
-            delete_node(wl, node->ins[i]);
+        if (!node->ins[i]->num_users) {
+            delete_node(ctx, wl, node->ins[i]);
         }
     }
 }
 
-static void replace_node(Worklist* wl, SB_Node* dest, SB_Node* src) {
-    while (dest->users) {
-        SB_User* u = dest->users;
-        dest->users = u->next;
-
-        u->node->ins[u->index] = src;
-
-        u->next = src->users;
-        src->users = u;
-    }
-
-    delete_node(wl, dest);
+// Moves every use of 'dest' over to 'src' as one block appended to src's use list. Only the
+// users' inputs and back positions change, nothing has to be searched. The users are
+// re-numbered when the caller puts them back on the worklist.
+static void replace_node(SB_Context* ctx, Worklist* wl, SB_Node* dest, SB_Node* src) {
+    move_users(ctx, dest, src);
+    delete_node(ctx, wl, dest);
 }
 
 typedef SB_Node*(*IdealizeFn)(SB_Context*, Worklist*, SB_Node*);
@@ -131,7 +139,8 @@ static SB_Node* idealize_phi(SB_Context* ctx, Worklist* wl, SB_Node* node) {
         if (same != node->ins[i]) { return node; }
     }
 
-    assert(same);
+    if (!same) { return node; } // Its region lost every input, so it goes once its users do
+
     worklist_push(wl, node->ins[0]); // Region may be able to be collapsed
     return same;
 }
@@ -140,7 +149,9 @@ static SB_Node* idealize_region(SB_Context* ctx, Worklist* wl, SB_Node* node) {
     (void)wl;
     (void)ctx;
 
-    for (SB_User* u = node->users; u; u = u->next) {
+    for (uint32_t i = 0; i < node->num_users; ++i) {
+        SB_User* u = &node->users[i];
+
         if (u->node->op == SB_OP_PHI && u->index == 0) {
             return node;
         }
@@ -158,38 +169,525 @@ static SB_Node* idealize_region(SB_Context* ctx, Worklist* wl, SB_Node* node) {
         }
     }
 
-    assert(same);
+    if (!same) { return node; } // Cut off by fold_constant_branches, it goes once its users do
+
     return same;
 }
 
-static IdealizeFn idealize_table[NUM_SB_OPS] = {
+// Control nodes the start reaches without passing through an arm in 'cut'. They are also pushed
+// onto 'order' as they are found, which puts every node after one of its inputs at least.
+static Bitset* get_control_reached(SB_Context* ctx, Arena* arena, SB_Proc* proc, Bitset* cut, Vec(SB_Node*)* order) {
+    Bitset* result = bitset_alloc(arena, ctx->next_id);
+    Vec(SB_Node*) stack = vec_new(arena, SB_Node*, 0);
+
+    bitset_set(result, proc->start->id);
+    vec_push(stack, proc->start);
+    vec_push(*order, proc->start);
+
+    while (vec_len(stack)) {
+        SB_Node* node = vec_pop(stack);
+
+        for (uint32_t i = 0; i < node->num_users; ++i) {
+            SB_Node* user = node->users[i].node;
+
+            if (!(user->flags & SB_NODE_FLAG_TRANSFERS_CONTROL) || bitset_get(cut, user->id) || bitset_get(result, user->id)) {
+                continue;
+            }
+
+            bitset_set(result, user->id);
+            vec_push(stack, user);
+            vec_push(*order, user);
+        }
+    }
+
+    return result;
+}
+
+// Removes region input 'index' and the phi inputs that go with it. Inputs left without users are
+// pushed for the worklist loop to delete, since deleting them here could take out phis of the
+// same region before they are visited.
+static void cut_region_input(SB_Context* ctx, Worklist* wl, SB_Node* region, int index) {
+    for (uint32_t i = 0; i < region->num_users; ++i) {
+        SB_Node* phi = region->users[i].node;
+        if (phi->op != SB_OP_PHI || region->users[i].index != 0) { continue; }
+
+        SB_Node* input = phi->ins[index + 1];
+        remove_input(phi, index + 1);
+
+        worklist_push(wl, phi);
+        if (!input->num_users) { worklist_push(wl, input); }
+    }
+
+    SB_Node* input = region->ins[index];
+    remove_input(region, index);
+
+    worklist_push(wl, region);
+    if (!input->num_users) { worklist_push(wl, input); }
+
+    invalidate_analyses(ctx);
+}
+
+static SB_Op get_taken_arm(SB_Node* branch) {
+    return VIEW_DATA(branch->ins[BRANCH_PREDICATE], uint64_t) ? SB_OP_BRANCH_THEN : SB_OP_BRANCH_ELSE;
+}
+
+// The control the taken arm of a folded branch carries on from. A run of folded branches, with
+// the regions between them down to one input, is looked through in one go so that each arm's
+// users move once, rather than once per branch further down the run.
+static SB_Node* get_folded_ctrl(SB_Node* branch, Bitset* folded) {
+    SB_Node* ctrl = branch->ins[BRANCH_CTRL];
+
+    for (;;) {
+        if (ctrl->op == SB_OP_REGION && ctrl->num_ins == 1) {
+            ctrl = ctrl->ins[0];
+            continue;
+        }
+
+        bool is_proj = ctrl->op == SB_OP_BRANCH_THEN || ctrl->op == SB_OP_BRANCH_ELSE;
+
+        if (is_proj && bitset_get(folded, ctrl->ins[PROJ_INPUT]->id) && ctrl->op == get_taken_arm(ctrl->ins[PROJ_INPUT])) {
+            ctrl = ctrl->ins[PROJ_INPUT]->ins[BRANCH_CTRL];
+            continue;
+        }
+
+        return ctrl;
+    }
+}
+
+// Folds the queued branches into the arm each always takes. Every edge from the control flow that
+// is only reachable through a dead arm into the rest of the proc is cut, regions inside the dead
+// part included so its loops come apart too, and the dead part is deleted bit by bit as it runs
+// out of users.
+//
+// A branch that is the only way out of a loop is left alone, as with the exit of a 'while 1'
+// loop. A loop that never exits has no other path to the end, so it would be dropped as dead
+// code. See get_stuck_loop_branches.
+static void fold_constant_branches(SB_Context* ctx, Worklist* wl, SB_Proc* proc) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 1, &wl->arena);
+
+    Vec(SB_Node*) branches = vec_new(scratch->arena, SB_Node*, 0);
+    Bitset* queued = bitset_alloc(scratch->arena, ctx->next_id);
+
+    for (size_t i = 0; i < vec_len(wl->constant_branches); ++i) {
+        SB_Node* branch = wl->constant_branches[i];
+
+        // Queued more than once, or deleted since
+        if (bitset_get(queued, branch->id) || !branch->num_users) { continue; }
+        bitset_set(queued, branch->id);
+
+        vec_push(branches, branch);
+    }
+
+    vec_clear(wl->constant_branches);
+
+    // Dead arms, less those of branches left alone
+    Bitset* cut = bitset_alloc(scratch->arena, ctx->next_id);
+
+    for (size_t i = 0; i < vec_len(branches); ++i) {
+        for (uint32_t j = 0; j < branches[i]->num_users; ++j) {
+            SB_Node* arm = branches[i]->users[j].node;
+
+            if (arm->op != get_taken_arm(branches[i])) {
+                bitset_set(cut, arm->id);
+            }
+        }
+    }
+
+    // Loops that never exit get their exits back, innermost first
+    for (;;) {
+        Vec(SB_Node*) stuck = get_stuck_loop_branches(ctx, scratch->arena, proc, cut);
+        if (!vec_len(stuck)) { break; }
+
+        for (size_t i = 0; i < vec_len(stuck); ++i) {
+            for (uint32_t j = 0; j < stuck[i]->num_users; ++j) {
+                bitset_unset(cut, stuck[i]->users[j].node->id);
+            }
+        }
+    }
+
+    // Anything still cut off from the end runs into a loop with no exit at all, which cannot be
+    // live. The branches on the way there are left alone all the same, until every branch that is
+    // folded gets to the end. This drops nothing for graphs the frontend builds.
+    for (bool left_any_alone = true; left_any_alone;) {
+        left_any_alone = false;
+
+        Bitset* reaching_end = get_control_reaching_end(ctx, scratch->arena, proc, cut);
+
+        for (size_t i = 0; i < vec_len(branches);) {
+            SB_Node* branch = branches[i];
+
+            bool has_cut_arm = false;
+
+            for (uint32_t j = 0; j < branch->num_users; ++j) {
+                has_cut_arm |= bitset_get(cut, branch->users[j].node->id);
+            }
+
+            if (has_cut_arm && bitset_get(reaching_end, branch->id)) {
+                ++i;
+                continue;
+            }
+
+            for (uint32_t j = 0; j < branch->num_users; ++j) {
+                bitset_unset(cut, branch->users[j].node->id);
+            }
+
+            branches[i] = vec_pop(branches);
+            left_any_alone |= has_cut_arm;
+        }
+    }
+
+    Vec(SB_Node*) reached_order = vec_new(scratch->arena, SB_Node*, 0);
+    Bitset* reached = get_control_reached(ctx, scratch->arena, proc, cut, &reached_order);
+
+    Bitset* dead = bitset_alloc(scratch->arena, ctx->next_id);
+    Vec(SB_Node*) stack = vec_new(scratch->arena, SB_Node*, 0);
+    Vec(SB_Node*) regions = vec_new(scratch->arena, SB_Node*, 0);
+
+    for (size_t i = 0; i < vec_len(branches); ++i) {
+        for (uint32_t j = 0; j < branches[i]->num_users; ++j) {
+            SB_Node* arm = branches[i]->users[j].node;
+
+            if (bitset_get(cut, arm->id)) {
+                bitset_set(dead, arm->id);
+                vec_push(stack, arm);
+            }
+        }
+    }
+
+    while (vec_len(stack)) {
+        SB_Node* node = vec_pop(stack);
+
+        for (uint32_t i = 0; i < node->num_users; ++i) {
+            SB_Node* user = node->users[i].node;
+
+            if (user->op == SB_OP_REGION) {
+                vec_push(regions, user);
+            }
+
+            if (!(user->flags & SB_NODE_FLAG_TRANSFERS_CONTROL) || bitset_get(reached, user->id) || bitset_get(dead, user->id)) {
+                continue;
+            }
+
+            bitset_set(dead, user->id);
+            vec_push(stack, user);
+        }
+    }
+
+    for (size_t i = 0; i < vec_len(regions); ++i) {
+        SB_Node* region = regions[i];
+
+        for (int j = region->num_ins; j-- > 0;) {
+            if (bitset_get(dead, region->ins[j]->id)) {
+                cut_region_input(ctx, wl, region, j);
+            }
+        }
+    }
+
+    Bitset* folded = bitset_alloc(scratch->arena, ctx->next_id);
+
+    for (size_t i = 0; i < vec_len(branches); ++i) {
+        bitset_set(folded, branches[i]->id);
+    }
+
+    // Branches further up go first, so the runs get_folded_ctrl looks through have already been
+    // folded down to a step or two. The ones in the dead part come last in any order.
+    Vec(SB_Node*) fold_order = vec_new(scratch->arena, SB_Node*, vec_len(branches));
+
+    for (size_t i = 0; i < vec_len(reached_order); ++i) {
+        if (bitset_get(folded, reached_order[i]->id)) {
+            vec_push(fold_order, reached_order[i]);
+        }
+    }
+
+    for (size_t i = 0; i < vec_len(branches); ++i) {
+        if (!bitset_get(reached, branches[i]->id)) {
+            vec_push(fold_order, branches[i]);
+        }
+    }
+
+    for (size_t i = 0; i < vec_len(fold_order); ++i) {
+        SB_Node* branch = fold_order[i];
+        SB_Node* ctrl = get_folded_ctrl(branch, folded);
+
+        for (uint32_t j = 0; j < branch->num_users; ++j) {
+            SB_Node* arm = branch->users[j].node;
+            if (arm->op != get_taken_arm(branch)) { continue; }
+
+            for (uint32_t k = 0; k < arm->num_users; ++k) {
+                worklist_push(wl, arm->users[k].node);
+            }
+
+            replace_node(ctx, wl, arm, ctrl);
+            break;
+        }
+    }
+
+    scratch_release(scratch);
+}
+
+// Folding has to know what control flow is left once the dead arm is gone, which takes a walk
+// over the whole proc, so branches on a constant are queued and folded together once the
+// worklist runs dry. See fold_constant_branches.
+static SB_Node* idealize_branch(SB_Context* ctx, Worklist* wl, SB_Node* node) {
+    (void)ctx;
+
+    if (node->ins[BRANCH_PREDICATE]->op == SB_OP_INT_CONST) {
+        vec_push(wl->constant_branches, node);
+    }
+
+    return node;
+}
+
+// Pattern macros for rules.inc
+
+#define LEFT(n) ((n)->ins[BINARY_LEFT])
+#define RIGHT(n) ((n)->ins[BINARY_RIGHT])
+#define IS_OP(n, op_name) ((n)->op == SB_OP_##op_name)
+#define IS_INT(n) IS_OP(n, INT_CONST)
+#define INT_VALUE(n) VIEW_DATA(n, uint64_t)
+#define IS_INT_VALUE(n, value) (IS_INT(n) && INT_VALUE(n) == (uint64_t)(value))
+#define SIGNED_VALUE(n) ((int64_t)INT_VALUE(n))
+#define SHIFT_AMOUNT(n) ((int)(INT_VALUE(n) & 63))
+
+// Constructor macros for rules.inc. These go through the regular builders, so a replacement that
+// already exists is found by value numbering rather than built again
+
+#define INT(value) sb_node_int_const(ctx, (uint64_t)(value))
+#define ADD(left, right) sb_node_add(ctx, left, right)
+#define SUB(left, right) sb_node_sub(ctx, left, right)
+#define MUL(left, right) sb_node_mul(ctx, left, right)
+#define SDIV(left, right) sb_node_sdiv(ctx, left, right)
+#define SHL(left, right) sb_node_shl(ctx, left, right)
+#define SAR(left, right) sb_node_sar(ctx, left, right)
+#define SHR(left, right) sb_node_shr(ctx, left, right)
+#define MULHI(left, right) sb_node_mulhi(ctx, left, right)
+
+static SB_Node* idealize_rules(SB_Context* ctx, Worklist* wl, SB_Node* node) {
+    (void)wl;
+
+    switch (node->op) {
+        #define RULES(op) case SB_OP_##op: {
+        #define RULE(pattern, replacement) if (pattern) { return replacement; }
+        #define END_RULES } break;
+        #include "rules.inc"
+        #undef RULES
+        #undef RULE
+        #undef END_RULES
+    }
+
+    return node;
+}
+
+static const IdealizeFn idealize_table[NUM_SB_OPS] = {
     [SB_OP_PHI] = idealize_phi,
     [SB_OP_REGION] = idealize_region,
+    [SB_OP_BRANCH] = idealize_branch,
+
+    #define RULES(op) [SB_OP_##op] = idealize_rules,
+    #define RULE(pattern, replacement)
+    #define END_RULES
+    #include "rules.inc"
+    #undef RULES
+    #undef RULE
+    #undef END_RULES
 };
 
-void sb_opt(SB_Context* ctx, SB_Proc* proc) {
-    (void)ctx;
+static SB_Node* idealize(SB_Context* ctx, Worklist* wl, SB_Node* node) {
+    IdealizeFn fn = idealize_table[node->op];
+    return fn ? fn(ctx, wl, node) : node;
+}
+
+// Strength reduction helpers for reduce.inc
+
+static bool is_power_of_two(uint64_t x) {
+    return x && !(x & (x - 1));
+}
+
+static int log2_exact(uint64_t x) {
+    assert(is_power_of_two(x));
+    return count_trailing_zeros64(x);
+}
 
-    Worklist wl = worklist_new();
-    init_worklist(&wl, proc);
+static uint64_t absolute_value(int64_t x) {
+    return x < 0 ? 0 - (uint64_t)x : (uint64_t)x;
+}
+
+// x / 0 and INT64_MIN / -1 have to keep trapping, and x / 1 is already a peephole
+static bool sdiv_reducible(int64_t divisor) {
+    return divisor != 0 && divisor != 1 && divisor != -1;
+}
+
+typedef struct {
+    int64_t multiplier;
+    int shift;
+} SignedMagic;
+
+// Warren, "Hacker's Delight", 10-4: the smallest multiplier and shift that give floor(x / d)
+// for every non-negative x. 'divisor' is not -1, 0 or 1.
+static SignedMagic get_signed_magic(int64_t divisor) {
+    const uint64_t two63 = (uint64_t)1 << 63;
+
+    uint64_t ad = absolute_value(divisor);
+    uint64_t t = two63 + ((uint64_t)divisor >> 63);
+    uint64_t anc = t - 1 - t % ad; // Absolute value of nc
+
+    uint64_t q1 = two63 / anc;
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad;
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta;
+
+    int p = 63;
+
+    do {
+        p++;
+
+        q1 *= 2;
+        r1 *= 2;
+
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+
+        q2 *= 2;
+        r2 *= 2;
+
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint64_t multiplier = q2 + 1;
+
+    return (SignedMagic) {
+        .multiplier = (int64_t)(divisor < 0 ? 0 - multiplier : multiplier),
+        .shift = p - 64,
+    };
+}
+
+// Signed division by a constant without a divide. Both forms round the quotient towards zero
+// like idiv does, by adding one to it (or a bias to x) when x is negative.
+static SB_Node* sdiv_by_constant(SB_Context* ctx, SB_Node* x, int64_t divisor) {
+    uint64_t ad = absolute_value(divisor);
+    SB_Node* q;
+
+    if (is_power_of_two(ad)) {
+        // (x + (x < 0 ? 2^k - 1 : 0)) >> k
+        int k = log2_exact(ad);
+        SB_Node* bias = SHR(SAR(x, INT(63)), INT(64 - k));
+        q = SAR(ADD(x, bias), INT(k));
+
+        return divisor < 0 ? SUB(INT(0), q) : q;
+    }
+
+    SignedMagic magic = get_signed_magic(divisor);
+    q = MULHI(x, INT(magic.multiplier));
+
+    // The multiplier only fits in 64 bits with the wrong sign in these cases
+    if (divisor > 0 && magic.multiplier < 0) {
+        q = ADD(q, x);
+    }
+    else if (divisor < 0 && magic.multiplier > 0) {
+        q = SUB(q, x);
+    }
+
+    if (magic.shift > 0) {
+        q = SAR(q, INT(magic.shift));
+    }
+
+    return ADD(q, SHR(q, INT(63))); // +1 when negative
+}
+
+// Nodes are brought into canonical form by the peephole rules first, so reduce.inc only ever
+// sees folded nodes with their constants on the right
+static SB_Node* reduce(SB_Context* ctx, Worklist* wl, SB_Node* node) {
+    SB_Node* ideal = idealize(ctx, wl, node);
+    if (ideal != node) { return ideal; }
+
+    switch (node->op) {
+        #define RULES(op) case SB_OP_##op: {
+        #define RULE(pattern, replacement) if (pattern) { return replacement; }
+        #define END_RULES } break;
+        #include "reduce.inc"
+        #undef RULES
+        #undef RULE
+        #undef END_RULES
+    }
+
+    return node;
+}
+
+#undef LEFT
+#undef RIGHT
+#undef IS_OP
+#undef IS_INT
+#undef INT_VALUE
+#undef IS_INT_VALUE
+#undef SIGNED_VALUE
+#undef SHIFT_AMOUNT
+#undef INT
+#undef ADD
+#undef SUB
+#undef MUL
+#undef SDIV
+#undef SHL
+#undef SAR
+#undef SHR
+#undef MULHI
+
+// Rewrites nodes with 'fn' and value numbers them until nothing changes
+static void optimize_to_fixed_point(SB_Context* ctx, SB_Proc* proc, IdealizeFn fn) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+
+    Worklist wl = worklist_new(scratch->arena, ctx->next_id);
+    init_worklist(ctx, scratch->arena, &wl, proc);
+
+    for (;;) {
+        if (worklist_empty(&wl)) {
+            if (!vec_len(wl.constant_branches)) { break; }
+            fold_constant_branches(ctx, &wl, proc);
+            continue;
+        }
 
-    while (!worklist_empty(&wl)) {
         SB_Node* node = worklist_pop(&wl);
 
-        if (idealize_table[node->op]) {
-            IdealizeFn fn = idealize_table[node->op];
-            SB_Node* ideal = fn(ctx, &wl, node);
+        // Left behind by fold_constant_branches
+        if (!node->num_users && node->op != SB_OP_END) {
+            delete_node(ctx, &wl, node);
+            continue;
+        }
+
+        SB_Node* ideal = fn(ctx, &wl, node);
 
-            if (ideal != node) {
-                replace_node(&wl, node, ideal);
-                node = ideal;
+        if (ideal == node) {
+            ideal = value_number(ctx, node);
+        }
 
-                for (SB_User* u = ideal->users; u; u = u->next) {
-                    worklist_push(&wl, u->node);
-                }
+        if (ideal != node) {
+            // Only the users that move over see a new input. The ideal's own users are left
+            // alone, as a control node can have thousands once branches fold into one block.
+            for (uint32_t i = 0; i < node->num_users; ++i) {
+                worklist_push(&wl, node->users[i].node);
             }
+
+            replace_node(ctx, &wl, node, ideal);
+
+            // A rewrite can hand back a node it just built, which may rewrite further itself
+            worklist_push(&wl, ideal);
         }
     }
 
-    worklist_destroy(&wl);
-} 
\ No newline at end of file
+    scratch_release(scratch);
+}
+
+void sb_opt(SB_Context* ctx, SB_Proc* proc) {
+    optimize_to_fixed_point(ctx, proc, idealize);
+}
+
+void sb_strength_reduce(SB_Context* ctx, SB_Proc* proc) {
+    optimize_to_fixed_point(ctx, proc, reduce);
+}
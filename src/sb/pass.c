@@ -0,0 +1,90 @@
+#include "internal.h"
+
+// Passes take a proc and return the proc to carry on with, which is only ever a different one for
+// passes that copy the graph, like compact. A pass that adds or removes control nodes invalidates
+// the cached analyses itself (see invalidate_analyses), so the ones that leave control flow alone
+// keep the analyses of earlier passes.
+
+typedef SB_Proc*(*PassFn)(SB_Context*, SB_Proc*);
+
+typedef struct {
+    char* name;
+    PassFn fn;
+} Pass;
+
+static SB_Proc* pass_peephole(SB_Context* ctx, SB_Proc* proc) {
+    sb_opt(ctx, proc);
+    return proc;
+}
+
+static SB_Proc* pass_strength_reduce(SB_Context* ctx, SB_Proc* proc) {
+    sb_strength_reduce(ctx, proc);
+    return proc;
+}
+
+static SB_Proc* pass_sccp(SB_Context* ctx, SB_Proc* proc) {
+    sb_sccp(ctx, proc);
+    return proc;
+}
+
+static SB_Proc* pass_compact(SB_Context* ctx, SB_Proc* proc) {
+    return sb_compact(ctx, proc);
+}
+
+static const Pass passes[] = {
+    { "peephole", pass_peephole }, // Rewrite rules and value numbering to a fixed point
+    { "sccp", pass_sccp }, // Constants through phis and branches, and unreachable control flow
+    { "strength-reduce", pass_strength_reduce }, // Multiplies and divides by constants to shifts and adds
+    { "compact", pass_compact }, // Drops dead nodes and renumbers the rest densely
+};
+
+static const char* pipelines[NUM_SB_OPT_LEVELS] = {
+    [SB_OPT_LEVEL_0] = "compact",
+    [SB_OPT_LEVEL_1] = "peephole,strength-reduce,compact",
+    [SB_OPT_LEVEL_2] = "peephole,sccp,peephole,strength-reduce,compact",
+};
+
+// Finds the pass named by 'name' up to the next comma or the end
+static const Pass* find_pass(const char* name, size_t length) {
+    for (int i = 0; i < ARRAY_LENGTH(passes); ++i) {
+        if (strlen(passes[i].name) == length && memcmp(passes[i].name, name, length) == 0) {
+            return &passes[i];
+        }
+    }
+
+    return 0;
+}
+
+bool sb_valid_pipeline(const char* pipeline) {
+    while (*pipeline) {
+        size_t length = strcspn(pipeline, ",");
+
+        if (!find_pass(pipeline, length)) {
+            return false;
+        }
+
+        pipeline += length;
+        if (*pipeline == ',') { pipeline++; }
+    }
+
+    return true;
+}
+
+SB_Proc* sb_run_pipeline(SB_Context* ctx, SB_Proc* proc, const char* pipeline) {
+    assert("unknown pass in pipeline" && sb_valid_pipeline(pipeline));
+
+    while (*pipeline) {
+        size_t length = strcspn(pipeline, ",");
+
+        proc = find_pass(pipeline, length)->fn(ctx, proc);
+
+        pipeline += length;
+        if (*pipeline == ',') { pipeline++; }
+    }
+
+    return proc;
+}
+
+SB_Proc* sb_optimize(SB_Context* ctx, SB_Proc* proc, SB_OptLevel level) {
+    return sb_run_pipeline(ctx, proc, pipelines[level]);
+}
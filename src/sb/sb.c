@@ -1,76 +1,127 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "internal.h"
 #include "containers.h"
 
+static Arena* new_node_arena() {
+    return arena_new_ex((ArenaDesc) { .huge_pages = true });
+}
+
 SB_Context* sb_init() {
-    Arena* arena = arena_new();
-    SB_Context* ctx = arena_type(arena, SB_Context);
-    ctx->arena = arena;
+    SB_Context* ctx = calloc(1, sizeof(SB_Context));
+    ctx->arena = new_node_arena();
+    ctx->spare_arena = new_node_arena();
     ctx->scratch_lib = scratch_library_new();
+    ctx->analysis_arena = arena_new();
     return ctx;
 }
 
 void sb_cleanup(SB_Context* ctx) {
+    sb_release_mappings(ctx);
+    value_table_destroy(&ctx->values);
     scratch_library_destroy(&ctx->scratch_lib);
+    arena_destroy(ctx->analysis_arena);
     arena_destroy(ctx->arena);
+    arena_destroy(ctx->spare_arena);
+    free(ctx);
+}
+
+void sb_reset(SB_Context* ctx) {
+    invalidate_analyses(ctx);
+    sb_release_mappings(ctx);
+    arena_reset(ctx->arena);
+    ctx->next_id = 0;
+
+    value_table_destroy(&ctx->values);
+    ctx->values = value_table_new();
+}
+
+ArenaStats sb_memory_stats(SB_Context* ctx) {
+    ArenaStats stats = arena_stats_combine(arena_stats(ctx->arena), scratch_library_stats(&ctx->scratch_lib));
+    stats = arena_stats_combine(stats, arena_stats(ctx->spare_arena));
+    stats = arena_stats_combine(stats, arena_stats(ctx->analysis_arena));
+    return stats;
+}
+
+void sb_reset_memory_peaks(SB_Context* ctx) {
+    arena_reset_peaks(ctx->arena);
+    arena_reset_peaks(ctx->spare_arena);
+    arena_reset_peaks(ctx->analysis_arena);
+    scratch_library_reset_peaks(&ctx->scratch_lib);
 }
 
 static void alloc_inputs(SB_Context* ctx, SB_Node* node, int num_ins) {
     assert(!node->num_ins);
     node->num_ins = num_ins;
-    node->ins = arena_array(ctx->arena, SB_Node*, num_ins);
+    node->ins = arena_zero(ctx->arena, input_array_size(num_ins));
 }
 
-static SB_Node* new_node(SB_Context* ctx, SB_Op op, int num_ins, SB_NodeFlags flags) {
-    SB_Node* node = arena_type(ctx->arena, SB_Node);
-    node->op = op;
-    node->flags = flags;
-    alloc_inputs(ctx, node, num_ins);
+static SB_Node* new_node_with_data(SB_Context* ctx, SB_Op op, int num_ins, int data_size, SB_NodeFlags flags) {
+    SB_Node* node = alloc_node(ctx->arena, num_ins, data_size);
+    node->op = (uint8_t)op;
+    node->flags = (uint8_t)flags;
+    node->id = ctx->next_id++;
     return node;
 }
 
-static void alloc_data_raw(SB_Context* ctx, SB_Node* node, int size) {
-    node->data_size = size;
-    node->data = arena_zero(ctx->arena, size);
+static SB_Node* new_node(SB_Context* ctx, SB_Op op, int num_ins, SB_NodeFlags flags) {
+    return new_node_with_data(ctx, op, num_ins, 0, flags);
 }
 
 static void set_input(SB_Context* ctx, SB_Node* node, int index, SB_Node* input) {
     assert(index < node->num_ins && !node->ins[index]);
     node->ins[index] = input;
-
-    SB_User* u = arena_type(ctx->arena, SB_User);
-    u->index = index;
-    u->node = node;
-
-    u->next = input->users;
-    input->users = u;
+    add_user(ctx->arena, node, index);
 }
 
-#define ALLOC_DATA(ctx, node, type) alloc_data_raw(ctx, node, sizeof(type))
 #define SET_INPUT(node, index, input) set_input(ctx, node, index, input)
 
+// Pure nodes are looked up with a probe on the stack before anything is allocated, so a value
+// that already exists is never built twice
+
 SB_Node* sb_node_null(SB_Context* ctx) {
-    return new_node(ctx, SB_OP_NULL, 0, SB_NODE_FLAG_NONE);
+    SB_Node probe = { .op = SB_OP_NULL };
+
+    SB_Node* n = find_value(ctx, &probe);
+    if (n) { return n; }
+
+    return value_number(ctx, new_node(ctx, SB_OP_NULL, 0, SB_NODE_FLAG_NONE));
 }
 
 SB_Node* sb_node_int_const(SB_Context* ctx, uint64_t value) {
-    SB_Node* n = new_node(ctx, SB_OP_INT_CONST, 0, SB_NODE_FLAG_NONE);    
-    ALLOC_DATA(ctx, n, uint64_t);
+    struct {
+        SB_Node node;
+        uint64_t value;
+    } probe = {
+        .node = { .op = SB_OP_INT_CONST, .data_size = sizeof(uint64_t) },
+        .value = value
+    };
+
+    SB_Node* n = find_value(ctx, &probe.node);
+    if (n) { return n; }
+
+    n = new_node_with_data(ctx, SB_OP_INT_CONST, 0, sizeof(uint64_t), SB_NODE_FLAG_NONE);
     VIEW_DATA(n, uint64_t) = value;
-    return n;
+    return value_number(ctx, n);
 }
 
 SB_Node* sb_node_alloca(SB_Context* ctx) {
     return new_node(ctx, SB_OP_ALLOCA, 0, SB_NODE_FLAG_NONE);
 }
 
-SB_Node* new_binary(SB_Context* ctx, SB_Op op, SB_Node* left, SB_Node* right) {
-    SB_Node* n = new_node(ctx, op, NUM_BINARY_INS, SB_NODE_FLAG_NONE);
+static SB_Node* new_binary(SB_Context* ctx, SB_Op op, SB_Node* left, SB_Node* right) {
+    SB_Node* ins[NUM_BINARY_INS] = { [BINARY_LEFT] = left, [BINARY_RIGHT] = right };
+    SB_Node probe = { .op = (uint8_t)op, .num_ins = NUM_BINARY_INS, .ins = ins };
+
+    SB_Node* n = find_value(ctx, &probe);
+    if (n) { return n; }
+
+    n = new_node(ctx, op, NUM_BINARY_INS, SB_NODE_FLAG_NONE);
     SET_INPUT(n, BINARY_LEFT, left);
     SET_INPUT(n, BINARY_RIGHT, right);
-    return n;
+    return value_number(ctx, n);
 }
 
 SB_Node* sb_node_add(SB_Context* ctx, SB_Node* left, SB_Node* right) {
@@ -89,6 +140,22 @@ SB_Node* sb_node_sdiv(SB_Context* ctx, SB_Node* left, SB_Node* right) {
     return new_binary(ctx, SB_OP_SDIV, left, right);
 }
 
+SB_Node* sb_node_shl(SB_Context* ctx, SB_Node* value, SB_Node* amount) {
+    return new_binary(ctx, SB_OP_SHL, value, amount);
+}
+
+SB_Node* sb_node_sar(SB_Context* ctx, SB_Node* value, SB_Node* amount) {
+    return new_binary(ctx, SB_OP_SAR, value, amount);
+}
+
+SB_Node* sb_node_shr(SB_Context* ctx, SB_Node* value, SB_Node* amount) {
+    return new_binary(ctx, SB_OP_SHR, value, amount);
+}
+
+SB_Node* sb_node_mulhi(SB_Context* ctx, SB_Node* left, SB_Node* right) {
+    return new_binary(ctx, SB_OP_MULHI, left, right);
+}
+
 SB_Node* sb_node_start(SB_Context* ctx) {
     return new_node(ctx, SB_OP_START, 0, SB_NODE_FLAG_STARTS_BASIC_BLOCK | SB_NODE_FLAG_TRANSFERS_CONTROL);
 }
@@ -181,35 +248,52 @@ SB_Node* sb_node_store(SB_Context* ctx, SB_Node* ctrl, SB_Node* mem, SB_Node* ad
 }
 
 typedef struct {
-    NodeSet* useful;
+    Bitset* useful;
+    ValueTable* values;
 } TrimUselessContext;
 
+// Also refills the value table with the live nodes only, so no dead node is handed out again
 static void trim_useless(SB_Node* node, void* _ctx) {
     TrimUselessContext* ctx = _ctx;
-    
-    for (SB_User** u = &node->users; *u;) {
-        if (node_set_contains(ctx->useful, (*u)->node)) {
-            u = &(*u)->next;
+
+    if (sb_op_is_pure[node->op]) {
+        value_table_insert(ctx->values, node);
+    }
+
+    for (uint32_t i = 0; i < node->num_users;) {
+        SB_User u = node->users[i];
+
+        if (bitset_get(ctx->useful, u.node->id)) {
+            i++;
         }
         else {
-            *u = (*u)->next;
+            remove_user(u.node, u.index);
         }
     }
 }
 
-SB_Proc* sb_proc(SB_Context* ctx, SB_Node* start, SB_Node* end) {
-    NodeSet useful = {0};
-    walk_graph(end, &useful, 0, 0);
+void remove_dead_nodes(SB_Context* ctx, SB_Node* start, SB_Node* end) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+
+    Bitset* useful = walk_graph(ctx, scratch->arena, end, 0, 0);
+
+    assert("the procedure never reaches the end node" && bitset_get(useful, start->id));
 
-    assert("the procedure never reaches the end node" && node_set_contains(&useful, start));
+    value_table_destroy(&ctx->values);
+    ctx->values = value_table_new();
 
     TrimUselessContext trim_useless_ctx = {
-        .useful = &useful
+        .useful = useful,
+        .values = &ctx->values
     };
 
-    walk_graph(end, 0, trim_useless, &trim_useless_ctx);
+    walk_graph(ctx, scratch->arena, end, trim_useless, &trim_useless_ctx);
 
-    node_set_destroy(&useful);
+    scratch_release(scratch);
+}
+
+SB_Proc* sb_proc(SB_Context* ctx, SB_Node* start, SB_Node* end) {
+    remove_dead_nodes(ctx, start, end);
 
     SB_Proc* proc = arena_type(ctx->arena, SB_Proc);
     proc->start = start;
@@ -224,74 +308,124 @@ static char* proj_name(SB_Op op) {
     return start + 1;
 }
 
-static void graphviz_node(NodeSet* visited, SB_Node* node, char* out, size_t out_sz) {
+// Projections are drawn as ports on the record of the node they project from
+static SB_Node* graphviz_record(SB_Node* node) {
+    while (node->flags & SB_NODE_FLAG_PROJECTION) {
+        node = node->ins[PROJ_INPUT];
+    }
+
+    return node;
+}
+
+static void graphviz_name(OutputBuffer* out, SB_Node* node) {
     if (node->flags & SB_NODE_FLAG_PROJECTION) {
-        char temp[512];
-        graphviz_node(visited, node->ins[PROJ_INPUT], temp, sizeof(temp));
-        sprintf_s(out, out_sz, "%s:p_%s", temp, proj_name(node->op));
+        graphviz_name(out, node->ins[PROJ_INPUT]);
+        output_printf(out, ":p_%s", proj_name(node->op));
         return;
     }
 
-    sprintf_s(out, out_sz, "n%p", node);
-
-    if (node_set_contains(visited, node)) { return; }
-    node_set_add(visited, node);
+    output_printf(out, "n%p", node);
+}
 
-    printf("  %s [shape=\"record\",label=\"{", out);
+static void graphviz_node(OutputBuffer* out, SB_Node* node) {
+    output_write(out, "  ", 2);
+    graphviz_name(out, node);
+    output_printf(out, " [shape=\"record\",label=\"{");
 
     if (node->num_ins) {
-        printf("{");
+        output_printf(out, "{");
 
         for (int i = 0; i < node->num_ins; ++i) {
-            if (i > 0) { printf("|"); }
-            printf("<i%d>%d", i, i);
+            if (i > 0) { output_printf(out, "|"); }
+            output_printf(out, "<i%d>%d", i, i);
         }
 
-        printf("}|");
+        output_printf(out, "}|");
     }
     
-    printf("{%s}", sb_op_mnemonic[node->op]);
+    output_printf(out, "{%s}", sb_op_mnemonic[node->op]);
 
     bool has_projections = false;
-    for (SB_User* u = node->users; u; u = u->next) {
-        if (u->node->flags & SB_NODE_FLAG_PROJECTION) {
+    for (uint32_t i = 0; i < node->num_users; ++i) {
+        if (node->users[i].node->flags & SB_NODE_FLAG_PROJECTION) {
             has_projections = true;
             break;
         }
     }
 
     if (has_projections) {
-        printf("|{");
+        output_printf(out, "|{");
         int count = 0;
-        for (SB_User* u = node->users; u; u = u->next) {
+        for (uint32_t i = 0; i < node->num_users; ++i) {
             if (count++ > 0) {
-                printf("|");
+                output_printf(out, "|");
             }
-            char* n = proj_name(u->node->op);
-            printf("<p_%s>%s", n, n);
+            char* n = proj_name(node->users[i].node->op);
+            output_printf(out, "<p_%s>%s", n, n);
         }
-        printf("}");
+        output_printf(out, "}");
     }
 
-    printf("}\"];\n");
+    output_printf(out, "}\"];\n");
+}
+
+// Depth first from the end with an explicit stack, so graph size is not bounded by the C stack.
+// A node's record is written when it is first reached and each input edge once the input's own
+// subgraph is done.
+void sb_graphviz(SB_Context* ctx, SB_Proc* proc) {
+    typedef struct {
+        SB_Node* node;
+        int next_input;
+    } Frame;
 
-    for (int i = 0; i < node->num_ins; ++i) {
-        if (node->ins[i]) {
-            char input_name[512];
-            graphviz_node(visited, node->ins[i], input_name, sizeof(input_name));
-            printf("  %s -> %s:i%d;\n", input_name, out, i);
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+
+    OutputBuffer out = output_new(scratch->arena);
+    output_printf(&out, "digraph G {\n");
+
+    Bitset* visited = bitset_alloc(scratch->arena, ctx->next_id);
+    Vec(Frame) stack = vec_new(scratch->arena, Frame, 0);
+
+    bitset_set(visited, proc->end->id);
+    graphviz_node(&out, proc->end);
+    vec_push(stack, ((Frame) { .node = proc->end }));
+
+    while (vec_len(stack)) {
+        Frame* top = &stack[vec_len(stack)-1];
+        SB_Node* node = top->node;
+
+        if (top->next_input == node->num_ins) {
+            vec_pop(stack);
+            continue;
         }
-    }
-}
 
-void sb_graphviz(SB_Proc* proc) {
-    printf("digraph G {\n");
+        SB_Node* input = node->ins[top->next_input];
+
+        if (!input) {
+            top->next_input++;
+            continue;
+        }
+
+        SB_Node* record = graphviz_record(input);
+
+        if (!bitset_get(visited, record->id)) {
+            bitset_set(visited, record->id);
+            graphviz_node(&out, record);
+            vec_push(stack, ((Frame) { .node = record }));
+            continue;
+        }
 
-    NodeSet visited = node_set_new();
-    char temp[512];
-    graphviz_node(&visited, proc->end, temp, sizeof(temp));
+        output_write(&out, "  ", 2);
+        graphviz_name(&out, input);
+        output_write(&out, " -> ", 4);
+        graphviz_name(&out, node);
+        output_printf(&out, ":i%d;\n", top->next_input);
 
-    node_set_destroy(&visited);
-        
-    printf("}\n\n");
-}
\ No newline at end of file
+        top->next_input++;
+    }
+
+    output_printf(&out, "}\n\n");
+    output_flush(&out, stdout);
+
+    scratch_release(scratch);
+}
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "core.h"
+
 #define X(name, ...) SB_OP_##name,
 typedef enum {
     SB_OP_INVALID,
@@ -11,7 +13,7 @@ typedef enum {
 #undef X
 
 #define X(name, mnemonic, ...) mnemonic,
-static const char* sb_op_mnemonic[] = {
+static const char* const sb_op_mnemonic[] = {
     "<error>",
     #include "ops.inc"
 };
@@ -29,23 +31,32 @@ typedef enum {
 typedef struct SB_Node SB_Node;
 typedef struct SB_User SB_User;
 
+// A node is a single allocation: this header, then its payload (e.g. an int constant's value),
+// then its inputs. 'ins' points at those inline inputs unless the node is a region or phi, whose
+// inputs are provided after creation and live in an array of their own.
+//
+// Uses are an array on the used node. For every input slot, the user also records where that
+// edge sits in the input's use list (right after 'ins', see internal.h), so an edge can be
+// unlinked without searching.
 struct SB_Node {
-    SB_Op op;
-    SB_NodeFlags flags;
+    uint8_t op; // SB_Op
+    uint8_t flags; // SB_NodeFlags
+    uint16_t data_size;
+
+    uint32_t id; // Dense per context, so passes can keep per-node state in arrays and bitsets
 
     int num_ins;
-    SB_Node** ins;
+    uint32_t num_users;
+    uint32_t user_capacity;
 
+    SB_Node** ins;
     SB_User* users;
-
-    int data_size;
-    void* data;
 };
 
-struct SB_User{ 
-    SB_User* next;
-    int index;
+// 'node' reads the used node as its input 'index'
+struct SB_User {
     SB_Node* node;
+    int index;
 };
 
 typedef struct {
@@ -78,11 +89,19 @@ typedef struct {
     SB_Block* control_flow_head;
 } SB_Schedule;
 
+// A context owns every arena its nodes and passes allocate from and shares no state with other
+// contexts, so separate contexts can build and optimize procedures on separate threads.
 typedef struct SB_Context SB_Context;
 
 SB_Context* sb_init();
 void sb_cleanup(SB_Context* ctx);
 
+// Frees every node and proc built so far, keeping the context's memory committed for reuse
+void sb_reset(SB_Context* ctx);
+
+ArenaStats sb_memory_stats(SB_Context* ctx);
+void sb_reset_memory_peaks(SB_Context* ctx);
+
 SB_Node* sb_node_null(SB_Context* ctx);
 SB_Node* sb_node_int_const(SB_Context* ctx, uint64_t value);
 
@@ -93,6 +112,11 @@ SB_Node* sb_node_sub (SB_Context* ctx, SB_Node* left, SB_Node* right);
 SB_Node* sb_node_mul (SB_Context* ctx, SB_Node* left, SB_Node* right);
 SB_Node* sb_node_sdiv(SB_Context* ctx, SB_Node* left, SB_Node* right);
 
+SB_Node* sb_node_shl  (SB_Context* ctx, SB_Node* value, SB_Node* amount);
+SB_Node* sb_node_sar  (SB_Context* ctx, SB_Node* value, SB_Node* amount);
+SB_Node* sb_node_shr  (SB_Context* ctx, SB_Node* value, SB_Node* amount);
+SB_Node* sb_node_mulhi(SB_Context* ctx, SB_Node* left, SB_Node* right);
+
 SB_Node* sb_node_start(SB_Context* ctx);
 SB_Node* sb_node_end(SB_Context* ctx, SB_Node* ctrl, SB_Node* mem, SB_Node* ret_val);
 
@@ -116,6 +140,38 @@ SB_Proc* sb_proc(SB_Context* ctx, SB_Node* start, SB_Node* end);
 
 void sb_opt(SB_Context* ctx, SB_Proc* proc); 
 
-void sb_graphviz(SB_Proc* proc);
+// Rewrites multiplication and signed division by constants into shifts, adds and multiply-highs
+void sb_strength_reduce(SB_Context* ctx, SB_Proc* proc);
+
+// Sparse conditional constant propagation: replaces values that are constant on every path that
+// reaches them and cuts control flow edges no execution takes
+void sb_sccp(SB_Context* ctx, SB_Proc* proc);
+
+// Copies the graph reachable from proc's end into a fresh arena and frees the old one. Every
+// other node and proc built in the context is discarded, so use the returned proc from here on.
+SB_Proc* sb_compact(SB_Context* ctx, SB_Proc* proc);
+
+typedef enum {
+    SB_OPT_LEVEL_0, // Only compacts, for the fastest builds
+    SB_OPT_LEVEL_1,
+    SB_OPT_LEVEL_2,
+    NUM_SB_OPT_LEVELS
+} SB_OptLevel;
+
+// Pipelines are comma separated pass names, e.g. "peephole,compact". Like sb_compact, these
+// return the proc to use from here on.
+bool sb_valid_pipeline(const char* pipeline);
+SB_Proc* sb_run_pipeline(SB_Context* ctx, SB_Proc* proc, const char* pipeline);
+SB_Proc* sb_optimize(SB_Context* ctx, SB_Proc* proc, SB_OptLevel level);
+
+void sb_graphviz(SB_Context* ctx, SB_Proc* proc);
+
+// Binary image of a proc, meant for caching optimized IR. Write a proc straight out of sb_compact,
+// whose graph is the whole context. Reading maps the file and patches it in place; the nodes stay
+// in the mapping until the context is reset or compacted. Writing returns false for a proc that is
+// not compacted or a file that cannot be written. Reading returns null if the file is missing,
+// malformed, or from an incompatible build.
+bool sb_write_proc(SB_Context* ctx, SB_Proc* proc, const char* path);
+SB_Proc* sb_read_proc(SB_Context* ctx, const char* path);
 
 void sb_generate_win64(SB_Context* ctx, SB_Proc* proc);
\ No newline at end of file
@@ -0,0 +1,361 @@
+#include "internal.h"
+#include "containers.h"
+
+// Sparse conditional constant propagation (Wegman and Zadeck, "Constant Propagation with
+// Conditional Branches"). Every node starts at the top of the lattice and only ever moves down:
+//
+//   LATTICE_TOP     no execution gets here, as far as is known yet
+//   LATTICE_CONST   always the same int, for values only
+//   LATTICE_BOTTOM  anything. For control and memory this just means reachable
+//
+// Unlike the peepholes, a phi only meets the inputs its region can reach it through, and a branch
+// projection is only reachable when the predicate allows it. So constants make it around loops
+// and through branches that they decide, which no rewrite of a single node can prove.
+//
+// The graph has no edge for a loop that never exits, it stays alive through its exit branch
+// alone. So an arm that a constant predicate rules out is still kept reachable when it is the
+// only way out to the end, see keep_loop_exits.
+
+typedef enum {
+    LATTICE_TOP,
+    LATTICE_CONST,
+    LATTICE_BOTTOM,
+} LatticeKind;
+
+typedef struct {
+    LatticeKind kind;
+    uint64_t value; // LATTICE_CONST only
+} Lattice;
+
+static const Lattice top = { .kind = LATTICE_TOP };
+static const Lattice bottom = { .kind = LATTICE_BOTTOM };
+
+static Lattice constant(uint64_t value) {
+    return (Lattice) { .kind = LATTICE_CONST, .value = value };
+}
+
+static Lattice meet(Lattice a, Lattice b) {
+    if (a.kind == LATTICE_TOP) { return b; }
+    if (b.kind == LATTICE_TOP) { return a; }
+
+    if (a.kind == LATTICE_CONST && b.kind == LATTICE_CONST && a.value == b.value) {
+        return a;
+    }
+
+    return bottom;
+}
+
+typedef struct {
+    Arena* arena; // Everything below lives here
+
+    Lattice* lattice; // Indexed by node ID
+    Bitset* kept; // Branch projections reachable regardless of the predicate
+    Bitset* is_live;
+
+    Vec(SB_Node*) stack;
+    Bitset* on_stack;
+} SCCP;
+
+static bool reached(Lattice* lattice, SB_Node* node) {
+    return lattice[node->id].kind != LATTICE_TOP;
+}
+
+// Same semantics as the folding rules in rules.inc
+static Lattice fold_binary(SB_Op op, uint64_t left, uint64_t right) {
+    switch (op) {
+        default:
+            assert(false);
+            return bottom;
+        case SB_OP_ADD:
+            return constant(left + right);
+        case SB_OP_SUB:
+            return constant(left - right);
+        case SB_OP_MUL:
+            return constant(left * right);
+        case SB_OP_SDIV:
+            return sdiv_traps(left, right) ? bottom : constant((uint64_t)((int64_t)left / (int64_t)right));
+        case SB_OP_SHL:
+            return constant(left << (right & 63));
+        case SB_OP_SAR:
+            return constant((uint64_t)((int64_t)left >> (right & 63)));
+        case SB_OP_SHR:
+            return constant(left >> (right & 63));
+        case SB_OP_MULHI:
+            return constant(signed_mulhi(left, right));
+    }
+}
+
+static Lattice evaluate(SCCP* sccp, SB_Node* node) {
+    static_assert(NUM_SB_OPS == 23, "handle the op in sccp");
+
+    Lattice* lattice = sccp->lattice;
+
+    switch (node->op) {
+        default:
+            assert(false);
+            return bottom;
+
+        case SB_OP_NULL:
+        case SB_OP_ALLOCA:
+        case SB_OP_START:
+            return bottom;
+
+        case SB_OP_INT_CONST:
+            return constant(VIEW_DATA(node, uint64_t));
+
+        case SB_OP_ADD:
+        case SB_OP_SUB:
+        case SB_OP_MUL:
+        case SB_OP_SDIV:
+        case SB_OP_SHL:
+        case SB_OP_SAR:
+        case SB_OP_SHR:
+        case SB_OP_MULHI: {
+            Lattice left = lattice[node->ins[BINARY_LEFT]->id];
+            Lattice right = lattice[node->ins[BINARY_RIGHT]->id];
+
+            if (left.kind == LATTICE_TOP || right.kind == LATTICE_TOP) {
+                return top;
+            }
+
+            if (left.kind == LATTICE_CONST && right.kind == LATTICE_CONST) {
+                return fold_binary(node->op, left.value, right.value);
+            }
+
+            return bottom;
+        }
+
+        // Reachable with their control input
+        case SB_OP_END:
+            return reached(lattice, node->ins[END_CTRL]) ? bottom : top;
+        case SB_OP_START_MEM:
+        case SB_OP_START_CTRL:
+            return reached(lattice, node->ins[PROJ_INPUT]) ? bottom : top;
+        case SB_OP_BRANCH:
+            return reached(lattice, node->ins[BRANCH_CTRL]) ? bottom : top;
+        case SB_OP_LOAD:
+            return reached(lattice, node->ins[LOAD_CTRL]) ? bottom : top;
+        case SB_OP_STORE:
+            return reached(lattice, node->ins[STORE_CTRL]) ? bottom : top;
+
+        case SB_OP_REGION: {
+            for (int i = 0; i < node->num_ins; ++i) {
+                if (reached(lattice, node->ins[i])) { return bottom; }
+            }
+
+            return top;
+        }
+
+        case SB_OP_PHI: {
+            SB_Node* region = node->ins[0];
+            Lattice result = top;
+
+            for (int i = 1; i < node->num_ins; ++i) {
+                if (reached(lattice, region->ins[i-1])) {
+                    result = meet(result, lattice[node->ins[i]->id]);
+                }
+            }
+
+            return result;
+        }
+
+        case SB_OP_BRANCH_THEN:
+        case SB_OP_BRANCH_ELSE: {
+            SB_Node* branch = node->ins[PROJ_INPUT];
+            Lattice predicate = lattice[branch->ins[BRANCH_PREDICATE]->id];
+
+            if (!reached(lattice, branch)) {
+                return top;
+            }
+
+            if (bitset_get(sccp->kept, node->id)) {
+                return bottom;
+            }
+
+            if (predicate.kind == LATTICE_TOP) {
+                return top;
+            }
+
+            if (predicate.kind == LATTICE_CONST && (predicate.value != 0) != (node->op == SB_OP_BRANCH_THEN)) {
+                return top;
+            }
+
+            return bottom;
+        }
+    }
+}
+
+static void collect_node(SB_Node* node, void* nodes) {
+    vec_push(*(Vec(SB_Node*)*)nodes, node);
+}
+
+// Cuts the inputs of reachable regions that no execution takes, along with the matching phi
+// inputs, and turns branches on a constant into straight control flow. Whatever was only
+// reachable through the cut edges is left for remove_dead_nodes.
+static bool prune_control(SB_Context* ctx, Lattice* lattice, Vec(SB_Node*) live) {
+    bool pruned = false;
+
+    for (size_t i = 0; i < vec_len(live); ++i) {
+        SB_Node* region = live[i];
+        if (region->op != SB_OP_REGION || !reached(lattice, region)) { continue; }
+
+        for (int j = region->num_ins; j-- > 0;) {
+            if (reached(lattice, region->ins[j])) { continue; }
+
+            for (uint32_t k = 0; k < region->num_users; ++k) {
+                SB_User u = region->users[k];
+
+                if (u.node->op == SB_OP_PHI && u.index == 0) {
+                    remove_input(u.node, j + 1);
+                }
+            }
+
+            remove_input(region, j);
+            pruned = true;
+        }
+    }
+
+    for (size_t i = 0; i < vec_len(live); ++i) {
+        SB_Node* branch = live[i];
+        if (branch->op != SB_OP_BRANCH || !reached(lattice, branch)) { continue; }
+
+        if (lattice[branch->ins[BRANCH_PREDICATE]->id].kind != LATTICE_CONST) { continue; }
+
+        SB_Node* taken = 0;
+        int num_reached = 0;
+
+        for (uint32_t j = 0; j < branch->num_users; ++j) {
+            if (reached(lattice, branch->users[j].node)) {
+                taken = branch->users[j].node;
+                num_reached++;
+            }
+        }
+
+        // The one projection still reachable carries on from the branch's own control. Both are
+        // when the other arm is kept as a loop's way out.
+        if (num_reached == 1) {
+            move_users(ctx, taken, branch->ins[BRANCH_CTRL]);
+            pruned = true;
+        }
+    }
+
+    return pruned;
+}
+
+static void push(SCCP* sccp, SB_Node* node) {
+    if (bitset_get(sccp->is_live, node->id) && !bitset_get(sccp->on_stack, node->id)) {
+        vec_push(sccp->stack, node);
+        bitset_set(sccp->on_stack, node->id);
+    }
+}
+
+static void propagate(SCCP* sccp) {
+    while (vec_len(sccp->stack)) {
+        SB_Node* node = vec_pop(sccp->stack);
+        bitset_unset(sccp->on_stack, node->id);
+
+        Lattice old = sccp->lattice[node->id];
+        Lattice new = evaluate(sccp, node);
+
+        sccp->lattice[node->id] = new;
+
+        // Phis read their region's inputs and projections their branch's predicate, so the users
+        // of regions and branches have to be revisited even when those keep their own value
+        bool changed = old.kind != new.kind || old.value != new.value;
+        if (!changed && node->op != SB_OP_REGION && node->op != SB_OP_BRANCH) { continue; }
+
+        for (uint32_t i = 0; i < node->num_users; ++i) {
+            push(sccp, node->users[i].node);
+        }
+    }
+}
+
+// Keeps the ruled out arms of the branches that are a loop's only way out to the end, see
+// get_stuck_loop_branches. Returns whether any arm was kept that was not before.
+static bool keep_loop_exits(SB_Context* ctx, SCCP* sccp, SB_Proc* proc, Vec(SB_Node*) live) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 1, &sccp->arena);
+
+    // Control that is not reached, dead nodes included
+    Bitset* blocked = bitset_alloc(scratch->arena, ctx->next_id);
+    bitset_fill(blocked);
+
+    for (size_t i = 0; i < vec_len(live); ++i) {
+        if (reached(sccp->lattice, live[i])) {
+            bitset_unset(blocked, live[i]->id);
+        }
+    }
+
+    Vec(SB_Node*) branches = get_stuck_loop_branches(ctx, scratch->arena, proc, blocked);
+
+    bool kept_any = false;
+
+    for (size_t i = 0; i < vec_len(branches); ++i) {
+        SB_Node* branch = branches[i];
+
+        for (uint32_t j = 0; j < branch->num_users; ++j) {
+            SB_Node* proj = branch->users[j].node;
+
+            if (bitset_get(sccp->is_live, proj->id) && !reached(sccp->lattice, proj)) {
+                bitset_set(sccp->kept, proj->id);
+                push(sccp, proj);
+                kept_any = true;
+            }
+        }
+    }
+
+    scratch_release(scratch);
+
+    return kept_any;
+}
+
+void sb_sccp(SB_Context* ctx, SB_Proc* proc) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+
+    Vec(SB_Node*) live = vec_new(scratch->arena, SB_Node*, 0);
+
+    SCCP sccp = {
+        .arena = scratch->arena,
+        .lattice = arena_array(scratch->arena, Lattice, ctx->next_id),
+        .kept = bitset_alloc(scratch->arena, ctx->next_id),
+        .is_live = walk_graph(ctx, scratch->arena, proc->end, collect_node, &live),
+        .on_stack = bitset_alloc(scratch->arena, ctx->next_id),
+    };
+
+    sccp.stack = vec_new(scratch->arena, SB_Node*, vec_len(live));
+
+    for (size_t i = 0; i < vec_len(live); ++i) {
+        push(&sccp, live[i]);
+    }
+
+    do {
+        propagate(&sccp);
+    } while (keep_loop_exits(ctx, &sccp, proc, live));
+
+    Lattice* lattice = sccp.lattice;
+    bool changed = false;
+
+    // With every loop exit that is needed kept, the end is always reachable
+    assert(reached(lattice, proc->end));
+
+    // Before constants are rewritten, as the int_consts made for them have no lattice entry
+    if (prune_control(ctx, lattice, live)) {
+        invalidate_analyses(ctx);
+        changed = true;
+    }
+
+    for (size_t i = 0; i < vec_len(live); ++i) {
+        SB_Node* node = live[i];
+        Lattice value = lattice[node->id];
+
+        if (value.kind == LATTICE_CONST && node->op != SB_OP_INT_CONST) {
+            move_users(ctx, node, sb_node_int_const(ctx, value.value));
+            changed = true;
+        }
+    }
+
+    scratch_release(scratch);
+
+    if (changed) {
+        remove_dead_nodes(ctx, proc->start, proc->end);
+    }
+}
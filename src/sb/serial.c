@@ -0,0 +1,419 @@
+#include <stdlib.h>
+
+#include "internal.h"
+#include "containers.h"
+#include "os.h"
+
+// The file is an image of the nodes as they sit in memory, so loading is a single mapping and a
+// pass that turns offsets back into pointers:
+//
+//   [FileHeader]
+//   [op mnemonics, each NUL terminated, padded to 8 bytes]
+//   [node records, in ID order]
+//
+// A node record is the SB_Node, its payload, its inputs and use positions (as alloc_node lays
+// them out) and finally its use list. Every pointer field holds an offset from the start of the
+// file instead, with 0 for a null input.
+//
+// Ops are stored by their position in ops.inc at write time. The mnemonic table maps them back
+// when ops.inc has changed since, and a file using an op that no longer exists is rejected.
+
+#define FILE_MAGIC 0x52494253 // "SBIR"
+#define FILE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t node_header_size; // sizeof(SB_Node) of the writer, records are only valid for the same layout
+    uint32_t num_ops;
+    uint32_t num_nodes;
+    uint32_t pad;
+
+    uint64_t size;
+    uint64_t nodes;
+    uint64_t start;
+    uint64_t end;
+} FileHeader;
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static size_t record_size(SB_Node* node) {
+    return sizeof(SB_Node)
+        + align8(node->data_size)
+        + align8(input_array_size(node->num_ins))
+        + node->num_users * sizeof(SB_User);
+}
+
+static void write_padding(OutputBuffer* out) {
+    static const char zeros[8];
+    output_write(out, zeros, align8(out->length) - out->length);
+}
+
+static void* as_offset(uint64_t offset) {
+    return (void*)(uintptr_t)offset;
+}
+
+static void collect_node(SB_Node* node, void* nodes) {
+    ((SB_Node**)nodes)[node->id] = node;
+}
+
+// Every ID is a node reachable from the end, and so is every user, as sb_compact leaves it
+static bool is_compacted(SB_Node** nodes, uint32_t num_nodes) {
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        if (!nodes[i]) {
+            return false;
+        }
+
+        for (uint32_t j = 0; j < nodes[i]->num_users; ++j) {
+            SB_Node* user = nodes[i]->users[j].node;
+
+            if (user->id >= num_nodes || nodes[user->id] != user) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool sb_write_proc(SB_Context* ctx, SB_Proc* proc, const char* path) {
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+
+    uint32_t num_nodes = ctx->next_id;
+
+    SB_Node** nodes = arena_array(scratch->arena, SB_Node*, num_nodes);
+    walk_graph(ctx, scratch->arena, proc->end, collect_node, nodes);
+
+    if (!is_compacted(nodes, num_nodes) || nodes[proc->start->id] != proc->start) {
+        scratch_release(scratch);
+        return false;
+    }
+
+    size_t mnemonics_size = 0;
+
+    for (int i = 0; i < NUM_SB_OPS; ++i) {
+        mnemonics_size += strlen(sb_op_mnemonic[i]) + 1;
+    }
+
+    uint64_t* offsets = arena_array(scratch->arena, uint64_t, num_nodes);
+    uint64_t cursor = sizeof(FileHeader) + align8(mnemonics_size);
+
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        offsets[i] = cursor;
+        cursor += record_size(nodes[i]);
+    }
+
+    FileHeader header = {
+        .magic = FILE_MAGIC,
+        .version = FILE_VERSION,
+        .node_header_size = sizeof(SB_Node),
+        .num_ops = NUM_SB_OPS,
+        .num_nodes = num_nodes,
+        .size = cursor,
+        .nodes = sizeof(FileHeader) + align8(mnemonics_size),
+        .start = offsets[proc->start->id],
+        .end = offsets[proc->end->id],
+    };
+
+    OutputBuffer out = output_new(scratch->arena);
+    output_write(&out, (char*)&header, sizeof(header));
+
+    for (int i = 0; i < NUM_SB_OPS; ++i) {
+        output_write(&out, sb_op_mnemonic[i], strlen(sb_op_mnemonic[i]) + 1);
+    }
+
+    write_padding(&out);
+
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        SB_Node* node = nodes[i];
+
+        uint64_t ins_offset = offsets[i] + sizeof(SB_Node) + align8(node->data_size);
+        uint64_t users_offset = ins_offset + align8(input_array_size(node->num_ins));
+
+        // Cleared padding and all, so a graph always writes the same bytes
+        SB_Node record;
+        memset(&record, 0, sizeof(record));
+
+        record.op = node->op;
+        record.flags = node->flags;
+        record.data_size = node->data_size;
+        record.id = node->id;
+        record.num_ins = node->num_ins;
+        record.num_users = node->num_users;
+        record.user_capacity = node->num_users;
+        record.ins = as_offset(ins_offset);
+        record.users = as_offset(users_offset);
+
+        output_write(&out, (char*)&record, sizeof(record));
+
+        output_write(&out, (char*)(node + 1), node->data_size);
+        write_padding(&out);
+
+        for (int j = 0; j < node->num_ins; ++j) {
+            SB_Node* input = node->ins[j] ? as_offset(offsets[node->ins[j]->id]) : 0;
+            output_write(&out, (char*)&input, sizeof(input));
+        }
+
+        output_write(&out, (char*)use_positions(node), node->num_ins * sizeof(uint32_t));
+        write_padding(&out);
+
+        for (uint32_t j = 0; j < node->num_users; ++j) {
+            SB_User user;
+            memset(&user, 0, sizeof(user));
+
+            user.node = as_offset(offsets[node->users[j].node->id]);
+            user.index = node->users[j].index;
+
+            output_write(&out, (char*)&user, sizeof(user));
+        }
+    }
+
+    assert(out.length == header.size);
+
+    bool ok = false;
+
+    FILE* file = os_open_file(path, "wb");
+
+    if (file) {
+        output_flush(&out, file);
+        ok = !ferror(file);
+        ok = fclose(file) == 0 && ok;
+    }
+
+    scratch_release(scratch);
+
+    return ok;
+}
+
+// Maps the ops of the file onto the current ops.inc by mnemonic
+static bool read_op_table(FileHeader* header, uint8_t* remap) {
+    char* mnemonic = (char*)(header + 1);
+    char* limit = (char*)header + header->nodes;
+
+    for (uint32_t i = 0; i < header->num_ops; ++i) {
+        char* terminator = memchr(mnemonic, '\0', (size_t)(limit - mnemonic));
+
+        if (!terminator) {
+            return false;
+        }
+
+        int op = 0;
+        while (op < NUM_SB_OPS && strcmp(sb_op_mnemonic[op], mnemonic) != 0) {
+            op++;
+        }
+
+        if (op == NUM_SB_OPS) {
+            return false;
+        }
+
+        remap[i] = (uint8_t)op;
+        mnemonic = terminator + 1;
+    }
+
+    return true;
+}
+
+static bool valid_header(FileHeader* header, size_t size) {
+    return size >= sizeof(FileHeader)
+        && header->magic == FILE_MAGIC
+        && header->version == FILE_VERSION
+        && header->node_header_size == sizeof(SB_Node)
+        && header->size == size
+        && header->num_ops <= 256
+        && header->nodes >= sizeof(FileHeader) && header->nodes <= size
+        && header->num_nodes <= (size - header->nodes) / sizeof(SB_Node)
+        && header->start < size && header->end < size;
+}
+
+// Index of the record starting at 'offset' in the ascending 'offsets', or -1 if none does
+static int64_t find_record(uint64_t* offsets, uint32_t num_records, uint64_t offset) {
+    uint32_t low = 0;
+    uint32_t high = num_records;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+
+        if (offsets[mid] < offset) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return low < num_records && offsets[low] == offset ? (int64_t)low : -1;
+}
+
+static bool is_record(uint64_t* offsets, uint32_t num_records, uint64_t offset) {
+    return find_record(offsets, num_records, offset) != -1;
+}
+
+// Payload bytes an op carries, matching the sb_node_* builders
+static int op_data_size(SB_Op op) {
+    return op == SB_OP_INT_CONST ? (int)sizeof(uint64_t) : 0;
+}
+
+static SB_Node* record_at(uint8_t* base, uint64_t* offsets, int64_t index) {
+    return (SB_Node*)(base + offsets[index]);
+}
+
+// Checks every record before anything is written through the file's offsets. Each record's
+// arrays have to be its own inline ones, its payload the size its op expects, and every input,
+// user, start and end offset has to be the start of a record. Every edge has to be recorded on
+// both ends: an input's use at the recorded position names this slot, and a user's input at the
+// recorded index is this record. Fills 'offsets' with where each record starts.
+static bool validate_records(uint8_t* base, size_t size, FileHeader* header, uint8_t* remap, uint64_t* offsets) {
+    uint64_t offset = header->nodes;
+
+    for (uint32_t i = 0; i < header->num_nodes; ++i) {
+        if (offset % 8 != 0 || size - offset < sizeof(SB_Node)) {
+            return false;
+        }
+
+        SB_Node* node = (SB_Node*)(base + offset);
+
+        if (node->op >= header->num_ops || node->num_ins < 0 || node->num_users > node->user_capacity) {
+            return false;
+        }
+
+        if (node->data_size != op_data_size(remap[node->op])) {
+            return false;
+        }
+
+        uint64_t ins_offset = offset + sizeof(SB_Node) + align8(node->data_size);
+        uint64_t users_offset = ins_offset + align8(input_array_size(node->num_ins));
+
+        if ((uintptr_t)node->ins != ins_offset || (uintptr_t)node->users != users_offset || size - offset < record_size(node)) {
+            return false;
+        }
+
+        offsets[i] = offset;
+        offset += record_size(node);
+    }
+
+    if (!is_record(offsets, header->num_nodes, header->start) || !is_record(offsets, header->num_nodes, header->end)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header->num_nodes; ++i) {
+        SB_Node* node = (SB_Node*)(base + offsets[i]);
+
+        SB_Node** ins = (SB_Node**)(base + (uintptr_t)node->ins);
+        uint32_t* positions = (uint32_t*)(ins + node->num_ins);
+        SB_User* users = (SB_User*)(base + (uintptr_t)node->users);
+
+        for (int j = 0; j < node->num_ins; ++j) {
+            if (!ins[j]) { continue; }
+
+            int64_t input = find_record(offsets, header->num_nodes, (uintptr_t)ins[j]);
+
+            if (input == -1 || positions[j] >= record_at(base, offsets, input)->num_users) {
+                return false;
+            }
+
+            SB_User use = ((SB_User*)(base + (uintptr_t)record_at(base, offsets, input)->users))[positions[j]];
+
+            if ((uintptr_t)use.node != offsets[i] || use.index != j) {
+                return false;
+            }
+        }
+
+        for (uint32_t j = 0; j < node->num_users; ++j) {
+            int64_t user = find_record(offsets, header->num_nodes, (uintptr_t)users[j].node);
+
+            if (user == -1 || users[j].index < 0 || users[j].index >= record_at(base, offsets, user)->num_ins) {
+                return false;
+            }
+
+            SB_Node** user_ins = (SB_Node**)(base + (uintptr_t)record_at(base, offsets, user)->ins);
+
+            if ((uintptr_t)user_ins[users[j].index] != offsets[i]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+SB_Proc* sb_read_proc(SB_Context* ctx, const char* path) {
+    size_t size;
+    uint8_t* base = os_map_file(path, &size);
+
+    if (!base) {
+        return 0;
+    }
+
+    FileHeader* header = (FileHeader*)base;
+    uint8_t remap[256];
+
+    if (!valid_header(header, size) || !read_op_table(header, remap)) {
+        os_unmap_file(base, size);
+        return 0;
+    }
+
+    Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
+    uint64_t* offsets = arena_array(scratch->arena, uint64_t, header->num_nodes);
+
+    if (!validate_records(base, size, header, remap, offsets)) {
+        scratch_release(scratch);
+        os_unmap_file(base, size);
+        return 0;
+    }
+
+    #define FIX_UP(ptr) ((void*)(base + (uintptr_t)(ptr)))
+
+    for (uint32_t i = 0; i < header->num_nodes; ++i) {
+        SB_Node* node = (SB_Node*)(base + offsets[i]);
+
+        node->op = remap[node->op];
+        node->id = ctx->next_id + i;
+        node->ins = FIX_UP(node->ins);
+        node->users = FIX_UP(node->users);
+
+        for (int j = 0; j < node->num_ins; ++j) {
+            if (node->ins[j]) {
+                node->ins[j] = FIX_UP(node->ins[j]);
+            }
+        }
+
+        for (uint32_t j = 0; j < node->num_users; ++j) {
+            node->users[j].node = FIX_UP(node->users[j].node);
+        }
+    }
+
+    SB_Proc* proc = arena_type(ctx->arena, SB_Proc);
+    proc->start = FIX_UP(header->start);
+    proc->end = FIX_UP(header->end);
+
+    #undef FIX_UP
+
+    ctx->next_id += header->num_nodes;
+
+    // Inputs are pointers again, so the pure nodes can be numbered
+    for (uint32_t i = 0; i < header->num_nodes; ++i) {
+        value_number(ctx, (SB_Node*)(base + offsets[i]));
+    }
+
+    scratch_release(scratch);
+
+    SB_Mapping* mapping = malloc(sizeof(SB_Mapping));
+    mapping->next = ctx->mappings;
+    mapping->base = base;
+    mapping->size = size;
+    ctx->mappings = mapping;
+
+    return proc;
+}
+
+void sb_release_mappings(SB_Context* ctx) {
+    while (ctx->mappings) {
+        SB_Mapping* mapping = ctx->mappings;
+        ctx->mappings = mapping->next;
+
+        os_unmap_file(mapping->base, mapping->size);
+        free(mapping);
+    }
+}
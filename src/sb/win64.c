@@ -3,7 +3,7 @@
 void sb_generate_win64(SB_Context* ctx, SB_Proc* proc) {
     Scratch* scratch = scratch_get(&ctx->scratch_lib, 0, 0);
 
-    schedule(scratch->arena, proc);
+    schedule(ctx, scratch->arena, proc);
 
     scratch_release(scratch);
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "core.h"
+
+// Control byte groups shared by HashSet/HashMap and the typed maps from hash_map.inc.
+//
+// Every slot has a control byte: EMPTY, DELETED, or the low 7 bits of the key's hash when full.
+// Slots are probed 16 at a time by comparing a whole group of control bytes against the hash tag
+// at once, so the key comparison only runs on slots that already match 7 bits of the hash.
+
+#define GROUP_SIZE 16
+#define MIN_CAPACITY GROUP_SIZE
+
+enum {
+    CTRL_EMPTY = 0x80,
+    CTRL_DELETED = 0xfe,
+};
+
+typedef uint32_t GroupMask; // Bit i set if slot i of the group matched
+
+static inline GroupMask group_match(uint8_t* group, uint8_t ctrl) {
+    #if HAVE_SSE2
+    __m128i bytes = _mm_loadu_si128((__m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+    #else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_SIZE; ++i) {
+        if (group[i] == ctrl) { mask |= (GroupMask)1 << i; }
+    }
+    return mask;
+    #endif
+}
+
+// Empty and deleted slots are the only ones with the top bit set
+static inline GroupMask group_match_free(uint8_t* group) {
+    #if HAVE_SSE2
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((__m128i*)group));
+    #else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_SIZE; ++i) {
+        if (group[i] & 0x80) { mask |= (GroupMask)1 << i; }
+    }
+    return mask;
+    #endif
+}
+
+static inline int lowest_bit(GroupMask mask) {
+    assert(mask);
+    #if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+    #else
+    return __builtin_ctz(mask);
+    #endif
+}
+
+static inline uint8_t hash_tag(uint64_t hash) {
+    return (uint8_t)(hash & 0x7f);
+}
+
+// Triangular probing over groups, which visits every group once when the group count is a power of two
+typedef struct {
+    size_t group;
+    size_t step;
+    size_t mask;
+} Probe;
+
+static inline Probe probe_start(size_t capacity, uint64_t hash) {
+    size_t mask = capacity / GROUP_SIZE - 1;
+    return (Probe) {
+        .group = (size_t)(hash >> 7) & mask,
+        .mask = mask,
+    };
+}
+
+static inline void probe_next(Probe* probe) {
+    probe->step++;
+    probe->group = (probe->group + probe->step) & probe->mask;
+}
+
+static inline size_t max_load(size_t capacity) {
+    return capacity - capacity / 8;
+}
+
+// Tombstones are not counted in 'used'. If clearing them leaves a quarter of the table free,
+// keep the size so insert/remove churn does not keep doubling the table.
+static inline size_t rehash_capacity(size_t capacity, size_t used) {
+    if (!capacity) {
+        return MIN_CAPACITY;
+    }
+
+    return used <= capacity / 8 * 5 ? capacity : capacity * 2;
+}
+
+static inline size_t probe_free(uint8_t* ctrl, size_t capacity, uint64_t hash) {
+    Probe probe = probe_start(capacity, hash);
+
+    while (true) {
+        GroupMask m = group_match_free(ctrl + probe.group * GROUP_SIZE);
+
+        if (m) {
+            return probe.group * GROUP_SIZE + lowest_bit(m);
+        }
+
+        assert("hash table has no free slots" && probe.step < probe.mask);
+        probe_next(&probe);
+    }
+}
+
+// A lookup only moves past a group that has no EMPTY slot. So removing from a group that still
+// has one cannot break any probe chain, and the slot goes straight back to EMPTY. Only removals
+// from groups that have been full leave a DELETED tombstone behind, and once those eat up the
+// load budget the table is rehashed at the same capacity rather than grown.
+static inline void ctrl_erase(uint8_t* ctrl, size_t index, size_t* growth_left) {
+    uint8_t* group = ctrl + (index & ~(size_t)(GROUP_SIZE - 1));
+
+    if (group_match(group, CTRL_EMPTY)) {
+        ctrl[index] = CTRL_EMPTY;
+        (*growth_left)++;
+    }
+    else {
+        ctrl[index] = CTRL_DELETED;
+    }
+}
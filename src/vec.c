@@ -5,6 +5,7 @@
 #define INITIAL_CAPACITY 8
 
 typedef struct {
+    Arena* arena; // Null for heap-backed vectors
     size_t capacity;
     size_t length;
 } Header;
@@ -14,7 +15,7 @@ static Header* get_hdr(void* vec) {
 }
 
 void vec_destroy(void* vec) {
-    if (vec) {
+    if (vec && !get_hdr(vec)->arena) {
         free(get_hdr(vec));
     }
 }
@@ -23,6 +24,33 @@ static size_t get_allocation_size(size_t stride, size_t capacity) {
     return sizeof(Header) + stride * capacity;
 }
 
+void* vec_alloc(Arena* arena, size_t stride, size_t capacity) {
+    if (!capacity) {
+        capacity = INITIAL_CAPACITY;
+    }
+
+    Header* hdr = arena_push(arena, get_allocation_size(stride, capacity));
+    hdr->arena = arena;
+    hdr->capacity = capacity;
+    hdr->length = 0;
+
+    return hdr + 1;
+}
+
+static Header* grow_in_arena(Header* hdr, size_t stride) {
+    size_t old_size = get_allocation_size(stride, hdr->capacity);
+    size_t new_size = get_allocation_size(stride, hdr->capacity * 2);
+
+    if (!arena_try_grow(hdr->arena, hdr, old_size, new_size)) {
+        Header* new_hdr = arena_push(hdr->arena, new_size);
+        memcpy(new_hdr, hdr, old_size);
+        hdr = new_hdr;
+    }
+
+    hdr->capacity *= 2;
+    return hdr;
+}
+
 void* vec_push_slot(void* vec, size_t stride) {
     Header* hdr;
 
@@ -31,13 +59,19 @@ void* vec_push_slot(void* vec, size_t stride) {
     }
     else {
         hdr = malloc(get_allocation_size(stride, INITIAL_CAPACITY));
+        hdr->arena = 0;
         hdr->capacity = INITIAL_CAPACITY;
         hdr->length = 0;
     }
 
     if (hdr->length == hdr->capacity) {
-        hdr->capacity *= 2;
-        hdr = realloc(hdr, get_allocation_size(stride, hdr->capacity));
+        if (hdr->arena) {
+            hdr = grow_in_arena(hdr, stride);
+        }
+        else {
+            hdr->capacity *= 2;
+            hdr = realloc(hdr, get_allocation_size(stride, hdr->capacity));
+        }
     }
 
     hdr->length++;
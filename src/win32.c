@@ -1,99 +1,94 @@
-#pragma once
+#ifdef _WIN32
 
 #include <Windows.h>
-#include "core.h"
-#include <stdio.h>
+#include "os.h"
 
-#define PAGE_LIMIT (1024 * 1024 * 10)
+size_t os_page_size() {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwPageSize;
+}
 
-struct Arena {
-    void* next_page;
-    size_t page_size;
+size_t os_huge_page_size() {
+    // MEM_LARGE_PAGES must be committed at reservation time and needs SeLockMemoryPrivilege,
+    // so huge page arenas fall back to regular pages here.
+    return os_page_size();
+}
 
-    size_t base;
-    size_t used;
-    size_t capacity;
-};
+void* os_reserve(size_t size, size_t alignment, bool huge_pages) {
+    (void)huge_pages;
 
-Arena* arena_new() {
     SYSTEM_INFO system_info;
     GetSystemInfo(&system_info);
 
-    size_t page_size = system_info.dwPageSize;
-    void* memory = VirtualAlloc(0, PAGE_LIMIT * page_size, MEM_RESERVE, PAGE_NOACCESS);
-    assert("virtual alloc failed" && memory);
+    // Reservations are aligned to the allocation granularity, which covers every alignment we ask for
+    assert(alignment <= system_info.dwAllocationGranularity);
+    (void)alignment;
 
-    Arena* arena = LocalAlloc(LMEM_ZEROINIT, sizeof(Arena));
-    arena->base = (size_t)memory;
-    arena->next_page = memory;
-    arena->capacity = 0;
-    arena->page_size = page_size;
+    return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);
+}
 
-    return arena;
+void os_release(void* base, size_t size) {
+    (void)size;
+    VirtualFree(base, 0, MEM_RELEASE);
 }
 
-void arena_destroy(Arena* arena) {
-    VirtualFree((void*)arena->base, 0, MEM_RELEASE);
-    LocalFree(arena);
+bool os_commit(void* ptr, size_t size) {
+    return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != 0;
 }
 
-void* arena_push(Arena* arena, size_t amount) {
-    if (!amount) {
+void os_decommit(void* ptr, size_t size) {
+    VirtualFree(ptr, size, MEM_DECOMMIT);
+}
+
+void* os_map_file(const char* path, size_t* size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
         return 0;
     }
 
-    amount = (amount + 7) & ~7;
+    void* base = 0;
+    LARGE_INTEGER file_size;
+
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+
+        if (mapping) {
+            base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
 
-    while (arena->used + amount > arena->capacity) {
-        void* result = VirtualAlloc(arena->next_page, arena->page_size, MEM_COMMIT, PAGE_READWRITE);
-        assert("memory commit failed" && result);
-        arena->next_page = (void*)((size_t)arena->next_page + arena->page_size);
-        arena->capacity += arena->page_size;
+            if (base) {
+                *size = (size_t)file_size.QuadPart;
+            }
+
+            // The view keeps the mapping and file alive on its own
+            CloseHandle(mapping);
+        }
     }
 
-    size_t result = arena->base + arena->used;
-    arena->used += amount;
+    CloseHandle(file);
 
-    return (void*)result;
+    return base;
 }
 
-void* arena_zero(Arena* arena, size_t amount) {
-    void* result = arena_push(arena, amount);
-    memset(result, 0, amount);
-    return result;
+FILE* os_open_file(const char* path, const char* mode) {
+    FILE* file;
+    return fopen_s(&file, path, mode) ? 0 : file;
 }
 
-Scratch* scratch_get(ScratchLibrary* lib, int num_conflicts, Arena** conflicts) {
-    for (int i = 0; i < ARRAY_LENGTH(lib->arenas); ++i) {
-        Arena* arena = lib->arenas[i];
+void os_unmap_file(void* base, size_t size) {
+    (void)size;
+    UnmapViewOfFile(base);
+}
 
-        bool does_conflict = false;
+uint64_t os_now_ns() {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
 
-        for (int j = 0; j < num_conflicts; ++j) {
-            if (conflicts[j] == arena) {
-                does_conflict = true;
-                break;
-            }
-        }
-
-        if (!does_conflict) {
-            size_t save = arena->used;
-            Scratch* scratch = arena_type(arena, Scratch);
-            scratch->arena = arena;
-            scratch->save = save;
-            return scratch;
-        }
-    }
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t remainder = counter.QuadPart % frequency.QuadPart;
 
-    assert("No non-conflicting scratch buffers available" && false);
-    return 0;
+    return seconds * 1000000000 + remainder * 1000000000 / frequency.QuadPart;
 }
 
-void scratch_release(Scratch* scratch) {
-    Arena* arena = scratch->arena;
-    size_t cur = scratch->arena->used;
-    arena->used = scratch->save;
-    #if _DEBUG
-    memset((uint8_t*)arena->base + arena->used, 0, cur-arena->used);
-    #endif
-}
\ No newline at end of file
+#endif